@@ -2,13 +2,21 @@
 #define jrttiannotationsH
 
 #include <vector>
+#include <map>
+#include <typeinfo>
 #include <boost/shared_ptr.hpp>
 #include <boost/pointer_cast.hpp>
 #include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#ifdef JRTTI_THREADS
+	#include <mutex>
+#endif
+#include "exception.hpp"
 
 namespace jrtti {
 
 class Annotations;
+class StringifyDelegateBase;
 
 /**
  * \brief Base class for annotations
@@ -31,6 +39,11 @@ public:
  * is not streamable.
  * You can create your own annotations by creating a class derived from Annotation
  * See sample.h for an example of use
+ *
+ * Annotations are indexed by their type when added, and the result of
+ * getFirst is kept per queried type, so repeated lookups do not scan the
+ * container. Lookups can run from several threads: with thread support the
+ * kept results are guarded by a mutex.
  */
 class Annotations
 {
@@ -38,7 +51,15 @@ public:
 	typedef std::vector< Annotation * > Container;
 	typedef Container::const_iterator iterator;
 
-	Annotations(){}
+	/**
+	 * \brief Flags for the jrtti built-in annotations
+	 */
+	enum BuiltinFlags { NoStreamableFlag = 1, ForceStreamLoadableFlag = 2 };
+
+	Annotations()
+		: m_builtinFlags( 0 ),
+		  m_stringifyDelegate( NULL )
+	{}
 	
 	Annotations( const Annotations& source ) {
 		*this = source;
@@ -57,6 +78,10 @@ public:
 			(*it)->owner = this;
 		}
 		m_annotations = source.m_annotations;
+		m_byType = source.m_byType;
+		clearFound();
+		m_builtinFlags = source.m_builtinFlags;
+		m_stringifyDelegate = source.m_stringifyDelegate;
 		return *this;
 	}
 
@@ -69,24 +94,34 @@ public:
 	operator << ( Annotation * annotation ) {
 		annotation->owner = this;
 		m_annotations.push_back( annotation );
+		m_byType.insert( TypeIndex::value_type( &typeid( *annotation ), annotation ) );
+		indexBuiltin( annotation );
+		clearFound();
 		return *this;
 	}
 
 	/**
 	 * \brief Get the first occurrence of annotation of type T
 	 *
+	 * The container is checked on the first query of each type T, and the
+	 * result is kept until an annotation is added.
 	 * \tparam T indicates the type of annotation to retrieve
 	 * \return the first occurrence of annotation of type T
 	 */
 	template< typename T >
 	T *
 	getFirst() {
-		for ( Container::iterator it = m_annotations.begin(); it != m_annotations.end(); ++it ) {
-			T * p = dynamic_cast< T* >( *it );
-			if ( p )
-				return p;
+		if ( m_annotations.empty() ) {
+			return NULL;
 		}
-		return NULL;
+#ifdef JRTTI_THREADS
+		std::lock_guard< std::mutex > lock( m_foundMutex );
+#endif
+		FoundMap::iterator it = m_found.find( &typeid( T ) );
+		if ( it == m_found.end() ) {
+			it = m_found.insert( FoundMap::value_type( &typeid( T ), findFirst< T >() ) ).first;
+		}
+		return static_cast< T * >( it->second );
 	}
 
 	/**
@@ -119,8 +154,76 @@ public:
 		return getFirst< T >() != NULL;
 	}
 
+	/**
+	 * \brief Built-in annotations held by this container
+	 *
+	 * Flags are computed when annotations are added, so checking them does not need RTTI.
+	 * \return a combination of BuiltinFlags
+	 */
+	int
+	builtinFlags() const {
+		return m_builtinFlags;
+	}
+
+	/**
+	 * \brief The first StringifyDelegate annotation
+	 * \return the StringifyDelegate or NULL if there is none
+	 */
+	StringifyDelegateBase *
+	stringifyDelegate() const {
+		return m_stringifyDelegate;
+	}
+
 private:
-	Container m_annotations;
+	struct TypeInfoLess {
+		bool
+		operator () ( const std::type_info * a, const std::type_info * b ) const {
+			return a->before( *b ) != 0;
+		}
+	};
+
+	// first annotation of each type, by exact type
+	typedef std::map< const std::type_info *, Annotation *, TypeInfoLess > TypeIndex;
+	// result of getFirst by queried type, as T *
+	typedef std::map< const std::type_info *, void *, TypeInfoLess > FoundMap;
+
+	/**
+	 * The first annotation of exactly type T is found through the type index,
+	 * and only the annotations added before it are checked for types derived
+	 * from T. Without annotations of type T the whole container is checked.
+	 */
+	template< typename T >
+	T *
+	findFirst() {
+		TypeIndex::const_iterator indexed = m_byType.find( &typeid( T ) );
+		T * exact = indexed == m_byType.end() ? NULL : static_cast< T * >( indexed->second );
+		for ( Container::iterator it = m_annotations.begin(); it != m_annotations.end() && *it != exact; ++it ) {
+			T * found = dynamic_cast< T* >( *it );
+			if ( found )
+				return found;
+		}
+		return exact;
+	}
+
+	void
+	clearFound() {
+#ifdef JRTTI_THREADS
+		std::lock_guard< std::mutex > lock( m_foundMutex );
+#endif
+		m_found.clear();
+	}
+
+	void
+	indexBuiltin( Annotation * annotation );
+
+	Container				m_annotations;
+	TypeIndex				m_byType;
+	FoundMap				m_found;
+#ifdef JRTTI_THREADS
+	std::mutex				m_foundMutex;
+#endif
+	int						m_builtinFlags;
+	StringifyDelegateBase *	m_stringifyDelegate;
 };
 
 /**
@@ -151,6 +254,58 @@ class ForceStreamLoadable : public Annotation {
 	//TODO: consirering the constness of references and pointers, this may be unnecesary
 };
 
+/**
+ * \brief Stable field id of a property in the binary format
+ *
+ * Metatype::toBinary identifies properties by field id instead of by name.
+ * Properties without FieldId get an id derived from their name, encoded in
+ * three bytes, and store their name once per type in the data, so data
+ * written with another schema is checked. Annotated ids take one byte up to
+ * 15 and two bytes up to 2047, store no name, and keep data readable when
+ * the property is renamed.
+ * Ids are read when the serialization plan of the metatype is built, so
+ * annotate properties when declaring them.
+ */
+class FieldId : public Annotation {
+public:
+	/**
+	 * \brief Constructor
+	 * \param id the field id, from 1 to 2047. Unique in its metatype
+	 * \throw Error if id is out of range
+	 */
+	FieldId( boost::uint32_t id )
+		: m_id( id )
+	{
+		if ( id == 0 || id > maxId ) {
+			throw Error( "FieldId out of range [1, 2047]" );
+		}
+	}
+
+	boost::uint32_t
+	id() const {
+		return m_id;
+	}
+
+	static const boost::uint32_t maxId = 2047;
+
+private:
+	boost::uint32_t m_id;
+};
+
+inline
+void
+Annotations::indexBuiltin( Annotation * annotation ) {
+	if ( dynamic_cast< NoStreamable * >( annotation ) ) {
+		m_builtinFlags |= NoStreamableFlag;
+	}
+	if ( dynamic_cast< ForceStreamLoadable * >( annotation ) ) {
+		m_builtinFlags |= ForceStreamLoadableFlag;
+	}
+	if ( !m_stringifyDelegate ) {
+		m_stringifyDelegate = dynamic_cast< StringifyDelegateBase * >( annotation );
+	}
+}
+
 /**
  * \brief Delegates for toStr and fromStr
  *
@@ -0,0 +1,106 @@
+#ifndef jrttiarrayreaderH
+#define jrttiarrayreaderH
+
+#include <istream>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Reads the elements of a JSON array from a stream one at a time
+ *
+ * The stream holds a JSON array of values of type T, or a collection as
+ * written by Metatype::toStr, whose "elements" are read. Each call to next
+ * deserializes a single element, and the text read is released as elements
+ * are consumed, so memory is bounded by the largest element, not by the
+ * array.
+ *
+ * Elements are independent: references to objects in previous elements are
+ * not resolved. Pointer elements are created as T, without polymorphism.
+ *
+ * \code
+ * std::ifstream in( "points.json" );
+ * ArrayReader< Point > points( in );
+ * Point p;
+ * while ( points.next( p ) ) {
+ *     process( p );
+ * }
+ * \endcode
+ */
+template< typename T >
+class ArrayReader {
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * Reads the text up to the first element.
+	 * \param in the stream holding the array
+	 * \throw Error if the stream does not hold an array or a collection
+	 */
+	ArrayReader( std::istream& in )
+		: m_type( jrtti::metatype< T >() ),
+		  m_reader( in ),
+		  m_inObject( false ),
+		  m_done( false )
+	{
+		if ( m_reader.readNull() ) {
+			m_done = true;
+			return;
+		}
+		if ( m_reader.peek() == '{' ) {
+			m_reader.beginObject();
+			m_inObject = true;
+			std::string key;
+			while ( m_reader.nextKey( key ) && key != "elements" ) {
+				m_reader.skip();
+			}
+			if ( key != "elements" ) {
+				throw Error( "JSON: collection without elements" );
+			}
+		}
+		m_reader.beginArray();
+	}
+
+	/**
+	 * \brief Reads the next element
+	 * \param element receives the element
+	 * \return false when there are no more elements
+	 */
+	bool
+	next( T& element ) {
+		if ( m_done ) {
+			return false;
+		}
+		m_reader.discard();
+		if ( !m_reader.nextElement() ) {
+			m_done = true;
+			if ( m_inObject ) {
+				std::string key;
+				while ( m_reader.nextKey( key ) ) {
+					m_reader.skip();
+				}
+			}
+			return false;
+		}
+		_nameRefMap().clear();
+		element = T();
+		boost::any value = m_type._read( boost::is_pointer< T >::value ? boost::any( T() ) : boost::any( &element ), m_reader, false );
+		if ( !value.empty() ) {
+			element = jrtti_cast< T >( value );
+		}
+		return true;
+	}
+
+private:
+	ArrayReader( const ArrayReader& );
+	ArrayReader& operator = ( const ArrayReader& );
+
+	Metatype&	m_type;
+	JSONReader	m_reader;
+	bool		m_inObject;		///< reading the elements of a collection object
+	bool		m_done;
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttiarrayreaderH
@@ -1,8 +1,7 @@
 #ifndef jrttibasetypesH
 #define jrttibasetypesH
 
-#include <sstream>
-#include <iomanip>
+#include <boost/type_traits/is_floating_point.hpp>
 #include "metatype.hpp"
 
 namespace jrtti {
@@ -20,6 +19,12 @@ public:
 		return m_baseType.create();
 	}
 
+	virtual
+	void
+	destroy( const boost::any& instance ) {
+		m_baseType.destroy( instance );
+	}
+
 	bool
 	isPointer() const {
 		return true;
@@ -35,6 +40,33 @@ public:
 		return m_baseType.isCollection();
 	}
 
+	virtual
+	size_t
+	size() const {
+		return sizeof( void * );
+	}
+
+	virtual
+	boost::any
+	clone( const boost::any& instance ) {
+		return m_baseType.clone( instance );
+	}
+
+	virtual
+	void
+	copy( const boost::any& dest, const boost::any& source ) {
+		m_baseType.copy( dest, source );
+	}
+
+	/**
+	 * Pointers are equal when they point to the same object
+	 */
+	virtual
+	bool
+	equals( const boost::any& a, const boost::any& b ) {
+		return get_instance_ptr( a ) == get_instance_ptr( b );
+	}
+
 protected:
 	Metatype *
 	pointerMetatype() {
@@ -51,49 +83,100 @@ protected:
 		return m_baseType._methods();
 	}
 
+	SerializationPlan&
+	_plan() {
+		return m_baseType._plan();
+	}
+
+	Metatype&
+	_objectType() {
+		return m_baseType;
+	}
+
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
 		void * inst = get_instance_ptr(value);
 
-		if ( !inst )
-			return "NULL";
+		if ( !inst ) {
+			writer.writeNull();
+			return;
+		}
+		if ( writer.writePointer( inst, m_baseType ) ) {
+			return;
+		}
 
-		AddressRefMap::iterator it = _addressRefMap().find( inst );
-		if ( it == _addressRefMap().end() ) {
-			return Metatype::_toStr( value, formatForStreaming );
+		size_t id;
+		if ( !_addressRefMap().find( inst, id ) ) {
+			Metatype::_write( value, writer, formatForStreaming );
 		}
 		else {
 			if ( formatForStreaming )
-				return "{\n\t\"$ref\": \"" + it->second + "\"\n}";
-			else 
-				return "{}";
+				writer.writeRef( _addressRefMap().idStr( id ) );
+			else {
+				writer.beginObject();
+				writer.endObject();
+			}
 		}
 	}
 
 	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-		JSONParser parser( str );
-		boost::any any_ptr;
+	_deepClone( const boost::any& instance, CloneMap& clones ) {
+		return m_baseType._deepClone( instance, clones );
+	}
+
+	virtual
+	bool
+	_deepEquals( const boost::any& a, const boost::any& b, ObjectPairing& pairing ) {
+		return m_baseType._deepEquals( a, b, pairing );
+	}
 
-		if ( str == "NULL" ) {
-			any_ptr = createAsNullPtr();
+	virtual
+	void
+	_fingerprint( const boost::any& value, Fingerprint& fp ) {
+		void * inst = get_instance_ptr( value );
+		size_t order;
+		if ( !inst ) {
+			fp.update( char( 0 ) );
+		}
+		else if ( fp.visited( inst, order ) ) {
+			fp.update( char( 1 ) );
+			fp.update( order );
 		}
 		else {
-			if ( parser.begin()->first == "$ref" ) {
-				void * ptr = _nameRefMap()[ parser.begin()->second ];
-				any_ptr = m_baseType.copyFromInstanceAsPtr( ptr );
-			}
-			else {
-				if ( jrtti_cast< void * >(instance) ) {
-					any_ptr = instance;
-				}
-				else {
-					any_ptr = create();
-				}
-				Metatype::_fromStr( any_ptr, str );
-			}
+			fp.update( char( 2 ) );
+			Metatype::_fingerprint( value, fp );
+		}
+	}
+
+	virtual
+	boost::any
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		if ( reader.readNull() ) {
+			return createAsNullPtr();
+		}
+		void * address;
+		if ( reader.readPointer( address ) ) {
+			return m_baseType.copyFromInstanceAsPtr( address );
+		}
+
+		reader.beginObject();
+		std::string key;
+		bool hasKeys = reader.nextKey( key );
+		if ( hasKeys && key == "$ref" ) {
+			return m_baseType.copyFromInstanceAsPtr( readRef( reader ) );
+		}
+
+		boost::any any_ptr;
+		if ( jrtti_cast< void * >(instance) ) {
+			any_ptr = instance;
+		}
+		else {
+			any_ptr = create();
+		}
+		if ( hasKeys ) {
+			_readMembers( any_ptr, reader, key, false );
 		}
 		return any_ptr;
 	}
@@ -121,9 +204,16 @@ private:
 
 // predefined types
 
-class MetaBool: public Metatype {
+/**
+ * \brief Base class for fundamental type abstractions
+ *
+ * Fundamental types are POD. Their values are copied and compared natively.
+ * \tparam T the fundamental type
+ */
+template< typename T >
+class MetaFundamental: public Metatype {
 public:
-	MetaBool(): Metatype( typeid( bool ) ) {}
+	MetaFundamental(): Metatype( typeid( T ) ) {}
 
 	virtual
 	bool
@@ -132,73 +222,129 @@ public:
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return boost::any_cast<bool>(value) ? "true" : "false";
+	bool
+	isPOD() const {
+		return true;
+	}
+
+	virtual
+	size_t
+	size() const {
+		return sizeof( T );
 	}
 
+	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
+	clone( const boost::any& instance ) {
+		return new T( jrtti_cast< T >( instance ) );
+	}
+
+	virtual
+	void
+	destroy( const boost::any& instance ) {
+		delete jrtti_cast< T * >( instance );
+	}
+
+	virtual
+	void
+	copy( const boost::any& dest, const boost::any& source ) {
+		*jrtti_cast< T * >( dest ) = jrtti_cast< T >( source );
+	}
+
+	virtual
+	bool
+	equals( const boost::any& a, const boost::any& b ) {
+		return jrtti_cast< T >( a ) == jrtti_cast< T >( b );
+	}
 
-		return str[0] == 't';
+protected:
+	virtual
+	bool
+	_comparesBytes() const {
+		return !boost::is_floating_point< T >::value;
 	}
 
 	virtual
 	boost::any
-	create() {
-		return new bool;
+	_deepClone( const boost::any& instance, CloneMap& clones ) {
+		return clone( instance );
 	}
-};
 
-class MetaChar: public Metatype {
-public:
-	MetaChar(): Metatype( typeid( char ) ) {}
+	virtual
+	bool
+	_deepEquals( const boost::any& a, const boost::any& b, ObjectPairing& pairing ) {
+		return equals( a, b );
+	}
+
+	virtual
+	void
+	_fingerprint( const boost::any& value, Fingerprint& fp ) {
+		fp.update( jrtti_cast< T >( value ) );
+	}
 
 	virtual
 	bool
-	isFundamental() const {
+	_fingerprintAt( const void * address, Fingerprint& fp ) {
+		fp.update( *static_cast< const T * >( address ) );
 		return true;
 	}
+};
 
+class MetaBool: public MetaFundamental< bool > {
+public:
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<char>(value));
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeBool( boost::any_cast<bool>(value) );
 	}
 
+	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-		return strToNum<char>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return reader.readBool();
 	}
 
 	virtual
 	boost::any
-	create()
-	{
-		return new char;
+	create() {
+		return new bool;
 	}
 };
 
-class MetaShort: public Metatype {
+class MetaChar: public MetaFundamental< char > {
 public:
-	MetaShort(): Metatype( typeid( short ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeChar( boost::any_cast<char>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<short>(value));
+	boost::any
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return reader.readChar();
 	}
 
+	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
+	create()
+	{
+		return new char;
+	}
+};
 
-		return strToNum<short>( str );
+class MetaShort: public MetaFundamental< short > {
+public:
+	virtual
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeInt( boost::any_cast<short>(value) );
+	}
+
+	virtual
+	boost::any
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return static_cast< short >( reader.readInt() );
 	}
 
 	virtual
@@ -209,26 +355,18 @@ public:
 	}
 };
 
-class MetaInt: public Metatype {
+class MetaInt: public MetaFundamental< int > {
 public:
-	MetaInt(): Metatype( typeid( int ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeInt( boost::any_cast<int>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<int>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-
-		return strToNum<int>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return static_cast< int >( reader.readInt() );
 	}
 
 	virtual
@@ -239,26 +377,18 @@ public:
 	}
 };
 
-class MetaLong: public Metatype {
+class MetaLong: public MetaFundamental< long > {
 public:
-	MetaLong(): Metatype( typeid( long ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeInt( boost::any_cast<long>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<long>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-
-		return strToNum<long>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return static_cast< long >( reader.readInt() );
 	}
 
 	virtual
@@ -269,26 +399,18 @@ public:
 	}
 };
 
-class MetaFloat: public Metatype {
+class MetaFloat: public MetaFundamental< float > {
 public:
-	MetaFloat(): Metatype( typeid( float ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeFloat( boost::any_cast<float>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<float>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-
-		return strToNum<float>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return static_cast< float >( reader.readDouble() );
 	}
 
 	virtual
@@ -299,26 +421,18 @@ public:
 };
 
 
-class MetaDouble: public Metatype {
+class MetaDouble: public MetaFundamental< double > {
 public:
-	MetaDouble(): Metatype( typeid( double ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeDouble( boost::any_cast<double>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<double>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-
-		return strToNum<double>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return reader.readDouble();
 	}
 
 	virtual
@@ -328,26 +442,18 @@ public:
 	}
 };
 
-class MetaLongDouble: public Metatype {
+class MetaLongDouble: public MetaFundamental< long double > {
 public:
-	MetaLongDouble(): Metatype( typeid( long double ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeLongDouble( boost::any_cast<long double>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr(boost::any_cast<long double>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-
-		return strToNum<long double>( str );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return reader.readLongDouble();
 	}
 
 	virtual
@@ -357,26 +463,18 @@ public:
 	}
 };
 
-class MetaWchar_t: public Metatype {
+class MetaWchar_t: public MetaFundamental< wchar_t > {
 public:
-	MetaWchar_t(): Metatype( typeid(wchar_t ) ) {}
-
 	virtual
-	bool
-	isFundamental() const {
-		return true;
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.writeInt( boost::any_cast<wchar_t>(value) );
 	}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		return numToStr((int)boost::any_cast<wchar_t>(value));
-	}
-
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-		int dummy = strToNum<int>( str );
-		return (wchar_t)dummy;
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return static_cast< wchar_t >( reader.readInt() );
 	}
 
 	virtual
@@ -391,15 +489,71 @@ public:
 	MetaString(): Metatype( typeid( std::string ) ) {}
 
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ) {
-		return '"' + addEscapeSeq( boost::any_cast<std::string>(value) ) + '"';
+	size_t
+	size() const {
+		return sizeof( std::string );
+	}
+
+	virtual
+	boost::any
+	clone( const boost::any& instance ) {
+		return new std::string( jrtti_cast< std::string >( instance ) );
+	}
+
+	virtual
+	void
+	destroy( const boost::any& instance ) {
+		delete jrtti_cast< std::string * >( instance );
+	}
+
+	virtual
+	void
+	copy( const boost::any& dest, const boost::any& source ) {
+		*jrtti_cast< std::string * >( dest ) = jrtti_cast< std::string >( source );
+	}
+
+	virtual
+	bool
+	equals( const boost::any& a, const boost::any& b ) {
+		return jrtti_cast< std::string >( a ) == jrtti_cast< std::string >( b );
+	}
+
+	virtual
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ) {
+		writer.writeString( boost::any_cast<std::string>(value) );
 	}
 
+	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
+	_deepClone( const boost::any& instance, CloneMap& clones ) {
+		return clone( instance );
+	}
+
+	virtual
+	bool
+	_deepEquals( const boost::any& a, const boost::any& b, ObjectPairing& pairing ) {
+		return equals( a, b );
+	}
 
-		return removeEscapeSeq( str );
+	virtual
+	void
+	_fingerprint( const boost::any& value, Fingerprint& fp ) {
+		const std::string * str = boost::any_cast< std::string >( &value );
+		fp.update( str ? *str : jrtti_cast< std::string >( value ) );
+	}
+
+	virtual
+	bool
+	_fingerprintAt( const void * address, Fingerprint& fp ) {
+		fp.update( *static_cast< const std::string * >( address ) );
+		return true;
+	}
+
+	virtual
+	boost::any
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
+		return reader.readString();
 	}
 
 	virtual
@@ -407,68 +561,6 @@ public:
 	create() {
 		return new std::string();
 	}
-private:
-	std::string
-	addEscapeSeq( const std::string& s ) {
-		std::ostringstream ss;
-		for (std::string::const_iterator iter = s.begin(); iter != s.end(); ++iter) {
-			switch (*iter) {
-				case '"': ss << "\\\""; break;
-				case '\\': ss << "\\\\"; break;
-				case '/': ss << "\\/"; break;
-				case '\b': ss << "\\b"; break;
-				case '\f': ss << "\\f"; break;
-				case '\n': ss << "\\n"; break;
-				case '\r': ss << "\\r"; break;
-				case '\t': ss << "\\t"; break;
-				default: {
-					if ( *iter < 0x20 ) {
-						ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << unsigned( *iter );
-					}
-					else {
-						ss << *iter;
-					}
-					break;
-				}
-			}
-		}
-		std::string ret = ss.str();
-		return ss.str();
-	}
-
-	std::string
-	removeEscapeSeq( const std::string& s ) {
-		std::stringstream ss;
-		for (std::string::const_iterator iter = s.begin(); iter != s.end(); ++iter) {
-			if ( *iter == '\\' )
-			{
-				switch ( *( ++iter ) ) {
-					case 'b' : ss << '\b'; break;
-					case 'f' : ss << '\f'; break;
-					case 'n' : ss << '\n'; break;
-					case 'r' : ss << '\r'; break;
-					case 't' : ss << '\t'; break;
-					case 'u' : {
-						std::string num;
-						for ( size_t i = 0; i<4; ++i,iter++ ) {
-							 num+= *(iter + 1);
-						}
-						std::stringstream d;
-						d << std::hex << num;
-						int n;
-						d >> n;
-						ss << char(n);
-						break;
-					}
-					default: ss << *iter; break;
-				}
-			}
-			else {
-				ss << *iter;
-			}
-		}
-		return ss.str();
-    }
 };
 
 //------------------------------------------------------------------------------
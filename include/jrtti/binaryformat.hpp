@@ -0,0 +1,729 @@
+#ifndef jrttibinaryformatH
+#define jrttibinaryformatH
+
+#include <vector>
+#include <map>
+#include <set>
+#include <cstring>
+#include "exception.hpp"
+#include "helpers.hpp"
+#include "format.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Constants of the compact binary format
+ *
+ * Data starts with the 4 byte signature, the schema fingerprint and the
+ * offset of the string table, both as 8 little endian bytes, followed by the
+ * root value, the string table and the field names table.
+ *
+ * Every value is preceded by its wire type: as the low 3 bits of a varint tag
+ * holding the field id in object members, or as a single byte in array
+ * elements and the root value. Members with field id 0 are followed by the
+ * index of their name in the string table. Type names are stored as Symbol
+ * values, also indexing the table, so names repeated by every element of a
+ * collection are stored once. Strings, objects and arrays are prefixed with
+ * their length in bytes, so any value is skipped without decoding it. Arrays
+ * also store their element count.
+ *
+ * Field ids derived from names may collide. The field names table stores, as
+ * string table indexes, the type name and the property name of every derived
+ * id written, once per type and field, so readers with another schema check
+ * them. Readers of data without it accept any property matched by id.
+ *
+ * Data of the first version, without string table and with names stored in
+ * place, is still read.
+ */
+struct BinaryFormat {
+	enum WireType {
+		Varint = 0,		///< zigzag encoded integers and bools
+		Fixed64 = 1,	///< double
+		Bytes = 2,		///< string
+		Null = 3,		///< null pointer, without payload
+		Object = 4,
+		Fixed32 = 5,	///< float
+		Array = 6,
+		Symbol = 7		///< index in the string table
+	};
+
+	static
+	const char *
+	signature() {
+		return "jrb\x02";
+	}
+
+	static const size_t signatureLength = 4;
+	static const size_t headerSize = 20;
+};
+
+/**
+ * \brief Writer producing the compact binary format
+ *
+ * Properties are identified by their field id. See Metatype::toBinary
+ */
+class BinaryWriter : public Writer {
+public:
+	/**
+	 * \brief Constructor
+	 * \param schemaFingerprint the fingerprint written in the header
+	 */
+	BinaryWriter( boost::uint64_t schemaFingerprint )
+		: m_fieldId( 0 ),
+		  m_finished( false ),
+		  m_fieldNameCount( 0 )
+	{
+		m_buf.append( BinaryFormat::signature(), BinaryFormat::signatureLength );
+		appendLittleEndian( schemaFingerprint, 8 );
+		appendLittleEndian( 0, 8 );
+	}
+
+	/**
+	 * \brief Completes the data with the string and field names tables
+	 *
+	 * Nothing can be written afterwards.
+	 * \return the binary encoded data
+	 */
+	const std::string&
+	str() {
+		if ( !m_finished ) {
+			m_finished = true;
+			size_t table = m_buf.size();
+			appendStringTable();
+			appendVarint( m_buf, m_fieldNameCount );
+			m_buf += m_fieldNames;
+			for ( int i = 0; i < 8; ++i ) {
+				m_buf[ BinaryFormat::headerSize - 8 + i ] = char( boost::uint64_t( table ) >> ( i * 8 ) );
+			}
+		}
+		return m_buf;
+	}
+
+	void
+	beginObject() {
+		open( BinaryFormat::Object );
+	}
+
+	void
+	writeId( const std::string& id ) {
+		key( "$id" );
+		writeIdValue( id );
+	}
+
+	void
+	key( const std::string& name ) {
+		m_name = name;
+		m_fieldId = 0;
+	}
+
+	void
+	field( const std::string& name, boost::uint32_t id ) {
+		m_name = name;
+		m_fieldId = id;
+	}
+
+	// names are described once per type and field id
+	void
+	derivedField( const std::string& type, const std::string& name, boost::uint32_t id, const std::string& jsonName ) {
+		BinaryWriter::field( name, id );
+		if ( m_finished ) {
+			return;
+		}
+		size_t typeSymbol = symbol( type );
+		if ( m_described.insert( std::make_pair( typeSymbol, id ) ).second ) {
+			appendVarint( m_fieldNames, typeSymbol );
+			appendVarint( m_fieldNames, id );
+			appendVarint( m_fieldNames, symbol( name ) );
+			++m_fieldNameCount;
+		}
+	}
+
+	void
+	endObject() {
+		close();
+	}
+
+	void
+	beginArray( size_t count ) {
+		open( BinaryFormat::Array );
+		appendVarint( m_buf, count );
+	}
+
+	void
+	endArray() {
+		close();
+	}
+
+	void
+	writeRef( const std::string& id ) {
+		beginObject();
+		key( "$ref" );
+		writeIdValue( id );
+		endObject();
+	}
+
+	void
+	writeNull() {
+		header( BinaryFormat::Null );
+	}
+
+	void
+	writeBool( bool value ) {
+		header( BinaryFormat::Varint );
+		m_buf += char( value ? 2 : 0 );
+	}
+
+	void
+	writeInt( boost::int64_t value ) {
+		header( BinaryFormat::Varint );
+		appendVarint( m_buf, ( boost::uint64_t( value ) << 1 ) ^ boost::uint64_t( value >> 63 ) );
+	}
+
+	void
+	writeFloat( float value ) {
+		boost::uint32_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		header( BinaryFormat::Fixed32 );
+		appendLittleEndian( bits, 4 );
+	}
+
+	void
+	writeDouble( double value ) {
+		boost::uint64_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		header( BinaryFormat::Fixed64 );
+		appendLittleEndian( bits, 8 );
+	}
+
+	void
+	writeString( const std::string& value ) {
+		header( BinaryFormat::Bytes );
+		appendVarint( m_buf, value.length() );
+		m_buf += value;
+	}
+
+	void
+	writeTypeName( const std::string& name ) {
+		header( BinaryFormat::Symbol );
+		appendVarint( m_buf, symbol( name ) );
+	}
+
+protected:
+	/**
+	 * Constructor for formats embedding binary values, without header.
+	 * They store the string table with appendStringTable.
+	 */
+	BinaryWriter()
+		: m_fieldId( 0 ),
+		  m_finished( true ),
+		  m_fieldNameCount( 0 )
+	{}
+
+	struct Container {
+		Container( size_t pstart, bool pisArray )
+			: start( pstart ),
+			  isArray( pisArray )
+		{}
+
+		size_t	start;		///< position of the content, after a one byte length
+		bool	isArray;
+	};
+
+	static
+	void
+	appendVarint( std::string& buf, boost::uint64_t value ) {
+		while ( value >= 0x80 ) {
+			buf += char( value | 0x80 );
+			value >>= 7;
+		}
+		buf += char( value );
+	}
+
+	void
+	appendLittleEndian( boost::uint64_t value, int bytes ) {
+		for ( int i = 0; i < bytes; ++i ) {
+			m_buf += char( value >> ( i * 8 ) );
+		}
+	}
+
+	// wire type of the next value, with its tag in objects
+	void
+	header( BinaryFormat::WireType type ) {
+		if ( m_open.empty() || m_open.back().isArray ) {
+			m_buf += char( type );
+			return;
+		}
+		appendVarint( m_buf, ( boost::uint64_t( m_fieldId ) << 3 ) | type );
+		if ( !m_fieldId ) {
+			appendVarint( m_buf, symbol( m_name ) );
+		}
+	}
+
+	// index of str in the string table, added if new
+	size_t
+	symbol( const std::string& str ) {
+		std::map< std::string, size_t >::iterator found = m_symbols.lower_bound( str );
+		if ( found == m_symbols.end() || found->first != str ) {
+			found = m_symbols.insert( found, std::make_pair( str, m_symbolNames.size() ) );
+			m_symbolNames.push_back( &found->first );
+		}
+		return found->second;
+	}
+
+	void
+	appendStringTable() {
+		appendVarint( m_buf, m_symbolNames.size() );
+		for ( std::vector< const std::string * >::iterator it = m_symbolNames.begin(); it != m_symbolNames.end(); ++it ) {
+			appendVarint( m_buf, ( *it )->length() );
+			m_buf += **it;
+		}
+	}
+
+	// most objects are shorter than 128 bytes, so one byte is reserved for the length
+	void
+	open( BinaryFormat::WireType type ) {
+		header( type );
+		m_buf += char( 0 );
+		m_open.push_back( Container( m_buf.size(), type == BinaryFormat::Array ) );
+	}
+
+	void
+	close() {
+		size_t start = m_open.back().start;
+		m_open.pop_back();
+		std::string length;
+		appendVarint( length, m_buf.size() - start );
+		m_buf[ start - 1 ] = length[ 0 ];
+		if ( length.length() > 1 ) {
+			m_buf.insert( start, length, 1, std::string::npos );
+		}
+	}
+
+	void
+	writeIdValue( const std::string& id ) {
+		if ( !id.empty() && id.length() < 19 && id.find_first_not_of( "0123456789" ) == std::string::npos ) {
+			writeInt( strToNum< boost::int64_t >( id ) );
+		}
+		else {
+			writeString( id );
+		}
+	}
+
+	std::string						m_buf;
+	std::vector< Container >		m_open;
+	std::string						m_name;		///< name of the next member
+	boost::uint32_t					m_fieldId;	///< field id of the next member
+	bool							m_finished;	///< string table written
+	std::map< std::string, size_t >	m_symbols;	///< string table index of names
+	std::vector< const std::string * >	m_symbolNames;	///< string table in index order
+	std::set< std::pair< size_t, boost::uint32_t > >	m_described;	///< type symbols and derived ids in the field names table
+	std::string						m_fieldNames;	///< field names table, without its count
+	size_t							m_fieldNameCount;
+};
+
+/**
+ * \brief Reader of the compact binary format
+ *
+ * Members are reported by field id, with an empty key, unless they were
+ * written by name. See Metatype::fromBinary
+ */
+class BinaryReader : public Reader {
+public:
+	/**
+	 * \brief Constructor
+	 * \param data the binary encoded data. Kept by reference, it must outlive the reader
+	 * \throw Error if data does not start with a binary format header
+	 */
+	BinaryReader( const std::string& data )
+		: m_data( data ),
+		  m_pos( 0 ),
+		  m_fieldId( 0 ),
+		  m_arraySize( 0 ),
+		  m_hasStringTable( false ),
+		  m_checkedType( NULL ),
+		  m_checkedNames( NULL )
+	{
+		// the last signature byte is the version
+		const size_t prefix = BinaryFormat::signatureLength - 1;
+		if ( m_data.length() < BinaryFormat::signatureLength || m_data.compare( 0, prefix, BinaryFormat::signature(), prefix ) != 0
+				|| m_data[ prefix ] < 1 || m_data[ prefix ] > BinaryFormat::signature()[ prefix ] ) {
+			throw Error( "Binary: data is not in binary format" );
+		}
+		m_pos = BinaryFormat::signatureLength;
+		m_schemaFingerprint = littleEndian( 8 );
+		if ( m_data[ prefix ] > 1 ) {
+			size_t table = size_t( littleEndian( 8 ) );
+			if ( table < BinaryFormat::headerSize || table > m_data.length() ) {
+				throw Error( "Binary: unexpected end of data" );
+			}
+			size_t root = m_pos;
+			m_pos = table;
+			readStringTable();
+			if ( m_pos < m_data.length() ) {
+				readFieldNames();
+			}
+			m_pos = root;
+		}
+		m_type = next();
+	}
+
+	/**
+	 * \brief Schema fingerprint of the writer
+	 * \return the fingerprint stored in the header
+	 * \sa Metatype::schemaFingerprint
+	 */
+	boost::uint64_t
+	schemaFingerprint() const {
+		return m_schemaFingerprint;
+	}
+
+	/**
+	 * \brief Check if names of derived field ids are checked
+	 * \return true if the data stores the names of its derived field ids
+	 */
+	bool
+	checksFieldNames() const {
+		return !m_fieldNames.empty();
+	}
+
+	/**
+	 * \brief Accepts any property matched by field id
+	 *
+	 * Called when the data was written with the schema of the reader, so its
+	 * field ids can not collide.
+	 */
+	void
+	skipFieldNameChecks() {
+		m_fieldNames.clear();
+		m_checkedType = NULL;
+	}
+
+	bool
+	readNull() {
+		return m_type == BinaryFormat::Null;
+	}
+
+	void
+	beginObject() {
+		open( BinaryFormat::Object, "object" );
+	}
+
+	bool
+	nextKey( std::string& key ) {
+		if ( atEnd() ) {
+			return false;
+		}
+		boost::uint64_t tag = readVarint();
+		m_type = int( tag & 7 );
+		m_fieldId = boost::uint32_t( tag >> 3 );
+		if ( m_fieldId ) {
+			key.clear();
+		}
+		else {
+			key = m_hasStringTable ? symbol() : readBytes();
+		}
+		return true;
+	}
+
+	boost::uint32_t
+	fieldId() const {
+		return m_fieldId;
+	}
+
+	// members of a type are read in sequence, so the ids of the last type checked are kept
+	bool
+	matchesField( const std::string& type, const std::string& name ) {
+		if ( m_fieldNames.empty() ) {
+			return true;
+		}
+		if ( &type != m_checkedType ) {
+			std::map< std::string, FieldNames >::const_iterator found = m_fieldNames.find( type );
+			m_checkedType = &type;
+			m_checkedNames = found == m_fieldNames.end() ? NULL : &found->second;
+		}
+		if ( !m_checkedNames ) {
+			return true;
+		}
+		FieldNames::const_iterator written = m_checkedNames->find( m_fieldId );
+		return written == m_checkedNames->end() || m_strings[ written->second ] == name;
+	}
+
+	void
+	beginArray() {
+		open( BinaryFormat::Array, "array" );
+		boost::uint64_t count = readVarint();
+		// elements take one byte at least, so corrupted counts do not reserve huge arrays
+		m_arraySize = size_t( std::min( count, boost::uint64_t( m_ends.back() - m_pos ) ) );
+	}
+
+	size_t
+	arraySize() const {
+		return m_arraySize;
+	}
+
+	bool
+	nextElement() {
+		if ( atEnd() ) {
+			return false;
+		}
+		m_type = next();
+		return true;
+	}
+
+	bool
+	readBool() {
+		return readInt() != 0;
+	}
+
+	boost::int64_t
+	readInt() {
+		switch ( m_type ) {
+			case BinaryFormat::Varint: {
+				boost::uint64_t value = readVarint();
+				return boost::int64_t( value >> 1 ) ^ -boost::int64_t( value & 1 );
+			}
+			case BinaryFormat::Fixed32:
+			case BinaryFormat::Fixed64:
+				return boost::int64_t( readDouble() );
+		}
+		throw mismatch( "integer" );
+	}
+
+	double
+	readDouble() {
+		if ( m_type == BinaryFormat::Fixed32 ) {
+			boost::uint32_t bits = boost::uint32_t( littleEndian( 4 ) );
+			float value;
+			memcpy( &value, &bits, sizeof( value ) );
+			return value;
+		}
+		if ( m_type == BinaryFormat::Fixed64 ) {
+			boost::uint64_t bits = littleEndian( 8 );
+			double value;
+			memcpy( &value, &bits, sizeof( value ) );
+			return value;
+		}
+		return double( readInt() );
+	}
+
+	std::string
+	readString() {
+		switch ( m_type ) {
+			case BinaryFormat::Bytes:
+				return readBytes();
+			case BinaryFormat::Symbol:
+				return symbol();
+			case BinaryFormat::Null:
+				return std::string();
+			case BinaryFormat::Varint:
+				// numeric ids
+				return numToStr( readInt() );
+		}
+		throw mismatch( "string" );
+	}
+
+	bool
+	readId( size_t& id, std::string& name ) {
+		if ( m_type == BinaryFormat::Varint ) {
+			id = size_t( readInt() );
+			return true;
+		}
+		return Reader::readId( id, name );
+	}
+
+	void
+	skip() {
+		switch ( m_type ) {
+			case BinaryFormat::Varint:
+			case BinaryFormat::Symbol:
+				readVarint();
+				break;
+			case BinaryFormat::Fixed32:
+				advance( 4 );
+				break;
+			case BinaryFormat::Fixed64:
+				advance( 8 );
+				break;
+			case BinaryFormat::Bytes:
+			case BinaryFormat::Object:
+			case BinaryFormat::Array:
+				advance( size_t( readVarint() ) );
+				break;
+			case BinaryFormat::Null:
+				break;
+			default:
+				throw mismatch( "value" );
+		}
+	}
+
+protected:
+	/**
+	 * Constructor for formats embedding binary values, without header.
+	 * The wire type of the first value is read with next.
+	 */
+	BinaryReader( const std::string& data, size_t pos )
+		: m_data( data ),
+		  m_pos( pos ),
+		  m_type( BinaryFormat::Null ),
+		  m_fieldId( 0 ),
+		  m_arraySize( 0 ),
+		  m_schemaFingerprint( 0 ),
+		  m_hasStringTable( false ),
+		  m_checkedType( NULL ),
+		  m_checkedNames( NULL )
+	{}
+
+	Error
+	mismatch( const std::string& expected ) const {
+		return Error( "Binary: " + expected + " expected at position " + numToStr( m_pos ) );
+	}
+
+	void
+	require( size_t bytes ) const {
+		if ( m_data.length() - m_pos < bytes ) {
+			throw Error( "Binary: unexpected end of data" );
+		}
+	}
+
+	void
+	advance( size_t bytes ) {
+		require( bytes );
+		m_pos += bytes;
+	}
+
+	int
+	next() {
+		require( 1 );
+		return static_cast< unsigned char >( m_data[ m_pos++ ] );
+	}
+
+	boost::uint64_t
+	readVarint() {
+		boost::uint64_t value = 0;
+		for ( int shift = 0; shift < 64; shift += 7 ) {
+			int c = next();
+			value |= boost::uint64_t( c & 0x7f ) << shift;
+			if ( !( c & 0x80 ) ) {
+				return value;
+			}
+		}
+		throw Error( "Binary: varint too long at position " + numToStr( m_pos ) );
+	}
+
+	boost::uint64_t
+	littleEndian( int bytes ) {
+		require( bytes );
+		boost::uint64_t value = 0;
+		for ( int i = 0; i < bytes; ++i ) {
+			value |= boost::uint64_t( static_cast< unsigned char >( m_data[ m_pos++ ] ) ) << ( i * 8 );
+		}
+		return value;
+	}
+
+	void
+	readStringTable() {
+		size_t count = size_t( readVarint() );
+		if ( count > m_data.length() - m_pos ) {
+			throw Error( "Binary: unexpected end of data" );
+		}
+		m_strings.resize( count );
+		for ( size_t i = 0; i < count; ++i ) {
+			m_strings[ i ] = readBytes();
+		}
+		m_hasStringTable = true;
+	}
+
+	void
+	readFieldNames() {
+		size_t count = size_t( readVarint() );
+		if ( count > m_data.length() - m_pos ) {
+			throw Error( "Binary: unexpected end of data" );
+		}
+		for ( size_t i = 0; i < count; ++i ) {
+			const std::string& type = symbol();
+			boost::uint32_t id = boost::uint32_t( readVarint() );
+			size_t name = size_t( readVarint() );
+			if ( name >= m_strings.size() ) {
+				throw mismatch( "string index" );
+			}
+			m_fieldNames[ type ][ id ] = name;
+		}
+	}
+
+	const std::string&
+	symbol() {
+		size_t index = size_t( readVarint() );
+		if ( index >= m_strings.size() ) {
+			throw mismatch( "string index" );
+		}
+		return m_strings[ index ];
+	}
+
+	std::string
+	readBytes() {
+		size_t length = size_t( readVarint() );
+		require( length );
+		std::string result( m_data, m_pos, length );
+		m_pos += length;
+		return result;
+	}
+
+	void
+	open( BinaryFormat::WireType type, const std::string& name ) {
+		if ( m_type != type ) {
+			throw mismatch( name );
+		}
+		size_t length = size_t( readVarint() );
+		require( length );
+		m_ends.push_back( m_pos + length );
+	}
+
+	// consumes the end of the innermost container if reached
+	bool
+	atEnd() {
+		if ( m_pos < m_ends.back() ) {
+			return false;
+		}
+		m_ends.pop_back();
+		return true;
+	}
+
+	const std::string&		m_data;
+	size_t					m_pos;
+	int						m_type;		///< wire type of the current value
+	boost::uint32_t			m_fieldId;	///< field id of the last key read
+	size_t					m_arraySize;	///< element count of the last array begun
+	boost::uint64_t			m_schemaFingerprint;
+	std::vector< size_t >	m_ends;		///< end positions of the open objects and arrays
+	bool					m_hasStringTable;	///< false for data of the first version
+	std::vector< std::string >	m_strings;	///< the string table
+
+	typedef std::map< boost::uint32_t, size_t >	FieldNames;	///< string table index of the name of derived ids
+
+	std::map< std::string, FieldNames >	m_fieldNames;	///< by type name. Empty if names are not checked
+	const std::string *	m_checkedType;		///< type of the last field checked
+	const FieldNames *	m_checkedNames;		///< names of the derived ids of m_checkedType
+};
+
+// entry points of Metatype, this header is reached from jrtti.hpp once Metatype is complete
+inline
+std::string
+Metatype::toBinary( const boost::any& instance ) {
+	BinaryWriter writer( schemaFingerprint() );
+	write( instance, writer, true );
+	return writer.str();
+}
+
+inline
+void
+Metatype::fromBinary( const boost::any& instance, const std::string& data ) {
+	BinaryReader reader( data );
+	if ( reader.checksFieldNames() && reader.schemaFingerprint() == schemaFingerprint() ) {
+		reader.skipFieldNameChecks();
+	}
+	read( instance, reader );
+}
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttibinaryformatH
@@ -0,0 +1,292 @@
+#ifndef jrttichangetrackerH
+#define jrttichangetrackerH
+
+#include <set>
+#include <map>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Per instance change tracking
+ *
+ * Records which properties of the tracked instances changed since the last
+ * snapshot. Changes are observed from reflective Property::set and
+ * Metatype::apply calls. Native code modifying an object behind jrtti should
+ * report it with jrtti::markChanged.
+ *
+ * The serialized value of each property is cached, so toStr only stringifies
+ * the properties changed since the previous call. Values reaching other
+ * objects through pointers or collections are not cached: changes to those
+ * objects are notified to them, not to the tracked instance, so they are
+ * written on each call, sharing the object references of the document.
+ * Values returned by reference, which other objects may reference, and
+ * properties with a stringify delegate are not cached either. The output is
+ * the one of Metatype::toStr, and the references of an enclosing write are
+ * kept.
+ *
+ * A tracker installs itself as the PropertyObserver on construction and
+ * restores the previous one on destruction, so trackers must be destroyed in
+ * reverse order of construction. Changes to untracked instances are forwarded
+ * to the previous observer. Observers are per thread, so a tracker only sees
+ * the changes made by the thread that constructed it.
+ */
+class ChangeTracker : public PropertyObserver {
+public:
+	typedef std::set< std::string > Changes;
+
+	ChangeTracker()
+		: m_previous( PropertyObserver::current() )
+	{
+		PropertyObserver::current() = this;
+	}
+
+	~ChangeTracker() {
+		PropertyObserver::current() = m_previous;
+	}
+
+	/**
+	 * \brief Starts tracking an instance
+	 *
+	 * A newly tracked instance has no changes.
+	 * \param mt the metatype of instance
+	 * \param instance the object address
+	 */
+	void
+	track( Metatype& mt, void * instance ) {
+		Entry& e = m_entries[ instance ];
+		e.metatype = &mt;
+		e.changes.clear();
+		e.cache.clear();
+	}
+
+	/**
+	 * \brief Stops tracking an instance
+	 * \param instance the object address
+	 */
+	void
+	untrack( void * instance ) {
+		m_entries.erase( instance );
+	}
+
+	/**
+	 * \brief Check if an instance is tracked
+	 * \param instance the object address
+	 * \return true if instance is tracked
+	 */
+	bool
+	isTracked( void * instance ) const {
+		return m_entries.find( instance ) != m_entries.end();
+	}
+
+	/**
+	 * \brief Records a property change
+	 * \param instance the object address
+	 * \param propertyName the name of the changed property
+	 */
+	void
+	propertyChanged( void * instance, const std::string& propertyName ) {
+		EntryMap::iterator it = m_entries.find( instance );
+		if ( it != m_entries.end() ) {
+			it->second.changes.insert( propertyName );
+			it->second.cache.erase( propertyName );
+		}
+		else if ( m_previous ) {
+			m_previous->propertyChanged( instance, propertyName );
+		}
+	}
+
+	/**
+	 * \brief Check if an instance changed since the last snapshot
+	 * \param instance the object address
+	 * \return true if any property changed
+	 * \throw Error if instance is not tracked
+	 */
+	bool
+	isChanged( void * instance ) {
+		return !entry( instance ).changes.empty();
+	}
+
+	/**
+	 * \brief The properties changed since the last snapshot
+	 * \param instance the object address
+	 * \return the names of the changed properties
+	 * \throw Error if instance is not tracked
+	 */
+	const Changes&
+	changes( void * instance ) {
+		return entry( instance ).changes;
+	}
+
+	/**
+	 * \brief Takes a snapshot, discarding the recorded changes
+	 * \param instance the object address
+	 * \throw Error if instance is not tracked
+	 */
+	void
+	snapshot( void * instance ) {
+		entry( instance ).changes.clear();
+	}
+
+	/**
+	 * \brief Returns a JSON string representing the tracked instance
+	 *
+	 * Only the properties changed since the previous call are stringified.
+	 * \param instance the object address
+	 * \param formatForStreaming if true, output is formatted as Metatype::toStr does for streaming
+	 * \return the JSON string
+	 * \throw Error if instance is not tracked
+	 */
+	std::string
+	toStr( void * instance, bool formatForStreaming = false ) {
+		return write( instance, formatForStreaming, false );
+	}
+
+	/**
+	 * \brief Returns a JSON string with the properties changed since the last snapshot
+	 *
+	 * The result can be loaded with Metatype::fromStr into another instance to
+	 * replay the changes.
+	 * \param instance the object address
+	 * \param formatForStreaming if true, output is formatted as Metatype::toStr does for streaming
+	 * \return the JSON string
+	 * \throw Error if instance is not tracked
+	 */
+	std::string
+	changesToStr( void * instance, bool formatForStreaming = false ) {
+		return write( instance, formatForStreaming, true );
+	}
+
+private:
+	typedef std::map< std::string, std::string > ValueCache;
+
+	struct Entry {
+		Entry()
+			: metatype( NULL ),
+			  formatForStreaming( false )
+		{}
+
+		Metatype *	metatype;
+		Changes		changes;
+		ValueCache	cache;
+		bool		formatForStreaming;	///< format of cached values
+	};
+
+	typedef std::map< void *, Entry > EntryMap;
+
+	Entry&
+	entry( void * instance ) {
+		EntryMap::iterator it = m_entries.find( instance );
+		if ( it == m_entries.end() ) {
+			throw Error( "Instance not tracked" );
+		}
+		return it->second;
+	}
+
+	std::string
+	write( void * instance, bool formatForStreaming, bool changesOnly ) {
+		Entry& e = entry( instance );
+		if ( e.formatForStreaming != formatForStreaming ) {
+			e.cache.clear();
+			e.formatForStreaming = formatForStreaming;
+		}
+
+		// the document has its own references, an enclosing write keeps its own
+		AddressRefScope refs;
+		_addressRefMap().insert( instance );
+		Metatype::SerializationPlan& plan = e.metatype->_plan();
+		JSONWriter writer;
+		writer.beginObject();
+		if ( formatForStreaming ) {
+			writer.writeId( "0" );
+		}
+
+		for( std::vector< Metatype::PlanEntry >::iterator pe = plan.entries.begin(); pe != plan.entries.end(); ++pe ) {
+			Property * prop = pe->property;
+			if ( !prop->isReadable() || ( formatForStreaming && !prop->isStreamable() ) ) {
+				continue;
+			}
+			if ( changesOnly && !e.changes.count( pe->name ) ) {
+				continue;
+			}
+			if ( prop->stringifyDelegate() ) {
+				writer.encodedField( pe->name, pe->fieldId, pe->jsonName );
+				writer.writeStringified( prop->stringifyDelegate()->toStr( instance ) );
+				continue;
+			}
+			// values reaching other objects, or reached by reference, share the references of the document
+			if ( !cacheable( *pe->metatype ) || !heldByValue( instance, *pe ) ) {
+				writer.encodedField( pe->name, pe->fieldId, pe->jsonName );
+				pe->metatype->_write( prop->get( instance ), writer, formatForStreaming );
+				continue;
+			}
+			ValueCache::iterator cached = e.cache.find( pe->name );
+			if ( cached == e.cache.end() ) {
+				cached = e.cache.insert( ValueCache::value_type( pe->name, stringify( instance, *pe, formatForStreaming ) ) ).first;
+			}
+			writer.encodedField( pe->name, pe->fieldId, pe->jsonName );
+			writer.writeStringified( cached->second );
+		}
+		writer.endObject();
+		return writer.str();
+	}
+
+	// cached values are independent subtrees where only instance is referenced
+	std::string
+	stringify( void * instance, Metatype::PlanEntry& pe, bool formatForStreaming ) {
+		AddressRefScope refs;
+		_addressRefMap().insert( instance );
+		return pe.metatype->_toStr( pe.property->get( instance ), formatForStreaming );
+	}
+
+	// true if values of mt reach no other object, so they only change through their owner
+	bool
+	cacheable( Metatype& mt ) {
+		std::map< Metatype *, bool >::iterator found = m_cacheable.find( &mt );
+		if ( found != m_cacheable.end() ) {
+			return found->second;
+		}
+		// recursive types reach themselves through a pointer or a collection
+		m_cacheable[ &mt ] = true;
+		bool result = !mt.isPointer() && !mt.isCollection();
+		for ( Metatype::PropertyMap::iterator it = mt._properties().begin(); result && it != mt._properties().end(); ++it ) {
+			Property * prop = it->second;
+			result = prop && !prop->stringifyDelegate() && !prop->isPending() && cacheable( prop->metatype() );
+		}
+		m_cacheable[ &mt ] = result;
+		return result;
+	}
+
+	// true if the property returns copies, which can not be referenced
+	bool
+	heldByValue( void * instance, Metatype::PlanEntry& pe ) {
+		std::map< Property *, bool >::iterator found = m_heldByValue.find( pe.property );
+		if ( found == m_heldByValue.end() ) {
+			bool result = pe.property->get( instance ).type() == pe.metatype->typeInfo();
+			found = m_heldByValue.insert( std::make_pair( pe.property, result ) ).first;
+		}
+		return found->second;
+	}
+
+	PropertyObserver *	m_previous;
+	EntryMap			m_entries;
+	std::map< Metatype *, bool >	m_cacheable;	///< by cacheable()
+	std::map< Property *, bool >	m_heldByValue;	///< by heldByValue()
+};
+
+/**
+ * \brief Reports a property change made by native code
+ *
+ * Call it from native setters or any code modifying an object behind jrtti,
+ * so the installed observer, usually a ChangeTracker, knows about it.
+ * \param instance the object address
+ * \param propertyName the name of the changed property
+ */
+inline
+void
+markChanged( void * instance, const std::string& propertyName ) {
+	PropertyObserver::notify( instance, propertyName );
+}
+
+}; //namespace jrtti
+#endif  //jrttichangetrackerH
@@ -2,9 +2,153 @@
 #define jrtticollectionH
 
 #include "metatype.hpp"
+#include <boost/move/utility_core.hpp>
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+#include <algorithm>
+#include <iterator>
+#include <exception>
+#ifndef BOOST_NO_CXX11_HDR_THREAD
+#include <thread>
+#endif
+#endif
 
 namespace jrtti {
 
+/**
+ * \brief Execution policy for Metacollection::invokeAll
+ *
+ * Elements are split in contiguous chunks, one per thread. The calling thread
+ * processes the first chunk. Without thread support invocations are always
+ * sequential.
+ */
+struct ExecutionPolicy {
+	/**
+	 * \brief Constructor
+	 * \param pthreads maximum number of threads. 0 means as many as hardware threads
+	 */
+	explicit
+	ExecutionPolicy( size_t pthreads = 1 )
+		: threads( pthreads )
+	{}
+
+	/**
+	 * \brief Policy invoking all elements in the calling thread
+	 */
+	static
+	ExecutionPolicy
+	sequential() {
+		return ExecutionPolicy( 1 );
+	}
+
+	/**
+	 * \brief Policy splitting elements across worker threads
+	 * \param threads maximum number of threads. 0 means as many as hardware threads
+	 */
+	static
+	ExecutionPolicy
+	parallel( size_t threads = 0 ) {
+		return ExecutionPolicy( threads );
+	}
+
+	size_t threads;	///< maximum number of threads
+};
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+namespace detail {
+	/**
+	 * Accumulates the results of invokeAll chunks
+	 */
+	template< typename ReturnT >
+	struct InvokeResults {
+		typedef std::vector< ReturnT >	Chunk;
+		typedef std::vector< ReturnT >	Type;
+
+		template< typename CallT >
+		static
+		void
+		add( Chunk& chunk, CallT call ) {
+			chunk.push_back( call() );
+		}
+
+		static
+		Type
+		merge( std::vector< Chunk >& chunks ) {
+			if ( chunks.size() == 1 ) {
+				return std::move( chunks[ 0 ] );
+			}
+			size_t total = 0;
+			for ( size_t i = 0; i < chunks.size(); ++i ) {
+				total += chunks[ i ].size();
+			}
+			Type result;
+			result.reserve( total );
+			for ( size_t i = 0; i < chunks.size(); ++i ) {
+				result.insert( result.end(), std::make_move_iterator( chunks[ i ].begin() ), std::make_move_iterator( chunks[ i ].end() ) );
+			}
+			return result;
+		}
+	};
+
+	template<>
+	struct InvokeResults< void > {
+		struct Chunk {};
+		typedef void Type;
+
+		template< typename CallT >
+		static
+		void
+		add( Chunk&, CallT call ) {
+			call();
+		}
+
+		static
+		void
+		merge( std::vector< Chunk >& ) {}
+	};
+}
+#endif
+
+namespace detail {
+	/**
+	 * True if container C has a reserve( size_type ) member, as std::vector
+	 */
+	template< typename C >
+	class HasReserve {
+		template< typename U, void ( U::* )( typename U::size_type ) > struct Check;
+		template< typename U > static char test( Check< U, &U::reserve > * );
+		template< typename U > static long test( ... );
+	public:
+		static const bool value = sizeof( test< C >( 0 ) ) == 1;
+	};
+
+	/**
+	 * True if container C has a back() member returning a reference to the element,
+	 * as sequences do. std::vector< bool > returns a proxy
+	 */
+	template< typename C >
+	class HasBack {
+		template< typename U, typename U::value_type& ( U::* )() > struct Check;
+		template< typename U > static char test( Check< U, &U::back > * );
+		template< typename U > static long test( ... );
+	public:
+		static const bool value = sizeof( test< C >( 0 ) ) == 1;
+	};
+
+	/**
+	 * True if container C has a resize( size_type ) member, default constructing
+	 * the new elements in place
+	 */
+	template< typename C >
+	class HasResize {
+		template< typename U, void ( U::* )( typename U::size_type ) > struct Check;
+		template< typename U > static char test( Check< U, &U::resize > * );
+		template< typename U > static long test( ... );
+	public:
+		static const bool value = sizeof( test< C >( 0 ) ) == 1;
+	};
+}
+
 /**
 * \brief Abstraction for a collection type
 *
@@ -15,6 +159,8 @@ namespace jrtti {
 * If contained elements are derived objects from a common ancestor, a property named 
 * __typeInfoName shoud be declare to jrtti so jrtti can stream elements properly.
 * This property should return typeid( *this ).name().
+* It is written before any other property of the element, as readers need it
+* to create the element.
 * In esence, a native collection type should implement the provided
 * interface CollectionInterface. Most STL container implementation are compatible
 * with CollectionInterface. That means you can directly use STL containers.
@@ -30,68 +176,372 @@ public:
 		return true;
 	}
 
+	bool
+	isPOD() const {
+		return false;
+	}
+
+	/**
+	 * \brief Compares two collections for equality
+	 *
+	 * Collections are equal if their properties are equal and have equal elements in the same order.
+	 * \param a first collection to compare
+	 * \param b second collection to compare
+	 * \return true if both collections are equal
+	 */
+	bool
+	equals( const boost::any& a, const boost::any& b ) {
+		if ( !Metatype::equals( a, b ) ) {
+			return false;
+		}
+		ClassT& colA = getReference( a );
+		ClassT& colB = getReference( b );
+		Metatype& mt = jrtti::metatype< typename ClassT::value_type >();
+		typename ClassT::iterator itA = colA.begin();
+		typename ClassT::iterator itB = colB.begin();
+		for ( ; itA != colA.end() && itB != colB.end(); ++itA, ++itB ) {
+			if ( !mt.equals( getElementPtr( *itA ), getElementPtr( *itB ) ) ) {
+				return false;
+			}
+		}
+		return !( itA != colA.end() ) && !( itB != colB.end() );
+	}
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+	/**
+	 * \brief Invokes a method on every element of a collection
+	 *
+	 * The method is resolved once in the metatype of the collection elements and
+	 * then called on each element in collection order.
+	 * \tparam ReturnT the return type of the method
+	 * \tparam Params the parameter types of the method
+	 * \param collection the collection instance
+	 * \param methodName the name of the method to invoke
+	 * \param params method parameters, passed to every call
+	 * \return the results of each call in collection order. void if method returns void
+	 * \throw Error if method not found
+	 * \throw BadCast if method signature does not match
+	 * \throw NullPtrError if an element is a null pointer
+	 */
+	template< typename ReturnT, typename... Params >
+	typename detail::InvokeResults< ReturnT >::Type
+	invokeAll( const boost::any& collection, const std::string& methodName, Params... params ) {
+		return invokeAll< ReturnT >( ExecutionPolicy::sequential(), collection, methodName, params... );
+	}
+
+	/**
+	 * \brief Invokes a method on every element of a collection
+	 *
+	 * As invokeAll( collection, methodName, params... ), splitting the elements
+	 * across threads as requested by policy. The method must be safe to invoke
+	 * concurrently on distinct elements. If any invocation throws, the first
+	 * exception in collection order is rethrown once all threads are done.
+	 * \param policy the execution policy
+	 * \param collection the collection instance
+	 * \param methodName the name of the method to invoke
+	 * \param params method parameters, passed to every call
+	 * \return the results of each call in collection order. void if method returns void
+	 */
+	template< typename ReturnT, typename... Params >
+	typename detail::InvokeResults< ReturnT >::Type
+	invokeAll( const ExecutionPolicy& policy, const boost::any& collection, const std::string& methodName, Params... params ) {
+		typedef detail::InvokeResults< ReturnT >	Results;
+		typedef SignedMethod< ReturnT, Params... >	MethodType;
+
+		Metatype& elemType = jrtti::metatype< typename ClassT::value_type >();
+		MethodType& method = static_cast< MethodType& >( elemType.signedMethod( methodName, typeid( ReturnT ( Params... ) ) ) );
+
+		ClassT& _collection = getReference( collection );
+		std::vector< void * > elements;
+		for ( typename ClassT::iterator it = _collection.begin() ; it != _collection.end(); ++it ) {
+			void * elem = getElementPtr( *it );
+			if ( !elem ) {
+				throw NullPtrError( "element " + numToStr( elements.size() ) + " of " + Metatype::name() );
+			}
+			elements.push_back( elem );
+		}
+
+		size_t threads = policy.threads;
+#ifndef BOOST_NO_CXX11_HDR_THREAD
+		if ( threads == 0 ) {
+			threads = std::thread::hardware_concurrency();
+		}
+#else
+		threads = 1;
+#endif
+		threads = std::max< size_t >( 1, std::min( threads, elements.size() ) );
+
+		std::vector< typename Results::Chunk > chunks( threads );
+		std::vector< std::exception_ptr > errors( threads );
+		size_t chunkSize = elements.size() / threads;
+		size_t remainder = elements.size() % threads;
+		auto run = [ & ]( size_t chunk ) {
+			size_t first = chunk * chunkSize + std::min( chunk, remainder );
+			size_t last = first + chunkSize + ( chunk < remainder ? 1 : 0 );
+			try {
+				for ( size_t i = first; i < last; ++i ) {
+					void * elem = elements[ i ];
+					Results::add( chunks[ chunk ], [ & ]() { return method.callInstance( elem, params... ); } );
+				}
+			}
+			catch ( ... ) {
+				errors[ chunk ] = std::current_exception();
+			}
+		};
+
+#ifndef BOOST_NO_CXX11_HDR_THREAD
+		std::vector< std::thread > workers;
+		workers.reserve( threads - 1 );
+		try {
+			for ( size_t chunk = 1; chunk < threads; ++chunk ) {
+				workers.push_back( std::thread( run, chunk ) );
+			}
+		}
+		catch ( ... ) {
+			// joinable threads can not be destroyed
+			for ( size_t i = 0; i < workers.size(); ++i ) {
+				workers[ i ].join();
+			}
+			throw;
+		}
+		run( 0 );
+		for ( size_t i = 0; i < workers.size(); ++i ) {
+			workers[ i ].join();
+		}
+#else
+		run( 0 );
+#endif
+		for ( size_t i = 0; i < errors.size(); ++i ) {
+			if ( errors[ i ] ) {
+				std::rethrow_exception( errors[ i ] );
+			}
+		}
+		return Results::merge( chunks );
+	}
+#endif
+
 protected:
 	virtual
-	std::string
-	_toStr( const boost::any & value, bool formatForStreaming ){
-		std::string props_str = Metatype::_toStr( value, formatForStreaming );
+	void
+	_write( const boost::any & value, Writer& writer, bool formatForStreaming ){
+		writer.beginObject();
+		writer.key( "properties" );
+		Metatype::_write( value, writer, formatForStreaming );
 		ClassT& _collection = getReference( value );
 
 		////////// COMPILER ERROR   //// Collections must declare a value_type type. See documentation for details.
 		Metatype * mt = &jrtti::metatype< typename ClassT::value_type >();
-		std::string str = "[\n";
-		bool need_nl = false;
 
 		////////// COMPILER ERROR   //// Collections must declare a iterator type and a begin and end methods. See documentation for details.
+		size_t count = 0;
 		for ( typename ClassT::iterator it = _collection.begin() ; it != _collection.end(); ++it ) {
-			if (need_nl) str += ",\n";
-			need_nl = true;
+			++count;
+		}
+		writer.key( "elements" );
+		writer.beginArray( count );
+		for ( typename ClassT::iterator it = _collection.begin() ; it != _collection.end(); ++it ) {
+			PropertyMap::iterator pmit = mt->_properties().find( "__typeInfoName" );
+			if ( pmit != mt->_properties().end() ) {
+				mt = &Reflector::instance().metatype( pmit->second->get< std::string >( getElementPtr( *it ) ) );
+			}
+			if ( boost::is_pointer< typename ClassT::value_type >::value && getElementPtr( *it ) ) {
+				Metatype * pointedType = mt->isPointer() ? &jrtti::metatype< typename boost::remove_pointer< typename ClassT::value_type >::type >() : mt;
+				if ( writer.writePointer( ( void * )getElementPtr( *it ), *pointedType ) ) {
+					continue;
+				}
+			}
+			mt->_write( *it, writer, formatForStreaming );
+		}
+		writer.endArray();
+		writer.endObject();
+	}
 
+	virtual
+	void
+	_deepCopyPointers( void * source, void * target, Metatype::CloneMap& clones ) {
+		Metatype::_deepCopyPointers( source, target, clones );
+		Metatype& mt = jrtti::metatype< typename ClassT::value_type >();
+		if ( mt.isFundamental() || mt.isPOD() || mt.typeInfo() == typeid( std::string ) ) {
+			return;
+		}
+		ClassT& sourceCollection = *static_cast< ClassT * >( source );
+		ClassT& targetCollection = *static_cast< ClassT * >( target );
+		if ( boost::is_pointer< typename ClassT::value_type >::value ) {
+			std::vector< typename ClassT::value_type > elements;
+			for ( typename ClassT::iterator it = sourceCollection.begin() ; it != sourceCollection.end(); ++it ) {
+				elements.push_back( jrtti_cast< typename ClassT::value_type >( mt._deepClone( *it, clones ) ) );
+			}
+			targetCollection.clear();
+			for ( size_t i = 0; i < elements.size(); ++i ) {
+				targetCollection.insert( targetCollection.end(), elements[ i ] );
+			}
+		}
+		else {
+			for ( typename ClassT::iterator it = targetCollection.begin() ; it != targetCollection.end(); ++it ) {
+				void * elem = ( void * )getElementPtr( *it );
+				mt._deepCopyPointers( elem, elem, clones );
+			}
+		}
+	}
+
+	virtual
+	bool
+	_deepEquals( const boost::any& a, const boost::any& b, Metatype::ObjectPairing& pairing ) {
+		if ( !Metatype::_deepEquals( a, b, pairing ) ) {
+			return false;
+		}
+		ClassT& colA = getReference( a );
+		ClassT& colB = getReference( b );
+		Metatype& mt = jrtti::metatype< typename ClassT::value_type >();
+		typename ClassT::iterator itA = colA.begin();
+		typename ClassT::iterator itB = colB.begin();
+		for ( ; itA != colA.end() && itB != colB.end(); ++itA, ++itB ) {
+			if ( !mt._deepEquals( getElementPtr( *itA ), getElementPtr( *itB ), pairing ) ) {
+				return false;
+			}
+		}
+		return !( itA != colA.end() ) && !( itB != colB.end() );
+	}
+
+	virtual
+	void
+	_fingerprint( const boost::any& value, Fingerprint& fp ) {
+		Metatype::_fingerprint( value, fp );
+		ClassT& _collection = getReference( value );
+		Metatype * mt = &jrtti::metatype< typename ClassT::value_type >();
+		size_t count = 0;
+		for ( typename ClassT::iterator it = _collection.begin() ; it != _collection.end(); ++it, ++count ) {
 			PropertyMap::iterator pmit = mt->_properties().find( "__typeInfoName" );
 			if ( pmit != mt->_properties().end() ) {
 				mt = &Reflector::instance().metatype( pmit->second->get< std::string >( getElementPtr( *it ) ) );
 			}
-			str += ident( mt->_toStr( *it, formatForStreaming ) );
+			mt->_fingerprint( *it, fp );
 		}
-		str += "\n]";
-		return "{\n" + ident( "\"properties\": " +props_str ) + ",\n" + ident( "\"elements\": " + str ) + "\n}";
+		fp.update( count );
 	}
 
 	virtual
 	boost::any
-	_fromStr( const boost::any& instance, const std::string& str, bool doCopyFromInstance = true ) {
-		JSONParser pre_parser( str );
-		Metatype::_fromStr( instance, pre_parser[ "properties" ], false );
+	_read( const boost::any& instance, Reader& reader, bool doCopyFromInstance = true ) {
 		ClassT& _collection =  getReference( instance );
 
 		////////// COMPILER ERROR   //// Collections must declare a clear method. See documentation for details.
 		_collection.clear();
-		JSONParser parser( pre_parser["elements"] );
-		for( JSONParser::iterator it = parser.begin(); it != parser.end(); ++it) {
-			Metatype * elemType;
-			JSONParser elemParser( it->second );
-			JSONParser::iterator found = elemParser.find( "__typeInfoName" );
-			if ( found != elemParser.end() ) {
-				elemType = &Reflector::instance().metatype( found->second );
+		reader.beginObject();
+		std::string key;
+		while ( reader.nextKey( key ) ) {
+			if ( key == "properties" ) {
+				Metatype::_read( instance, reader, false );
 			}
-			else {
-				elemType = &Reflector::instance().metatype< ClassT::value_type >();
-			}
-			typename ClassT::value_type elem;
-			if ( boost::is_pointer< ClassT::value_type >::value ) {
-//				elem = *boost::unsafe_any_cast< ClassT::value_type >( &elemType->create() );
-				elem = jrtti_cast< ClassT::value_type >( elemType->create() );
-				elemType->_fromStr( elem, it->second, false );
-				_collection.insert( _collection.end(), elem );
+			else if ( key == "elements" ) {
+				readElements( _collection, reader );
 			}
 			else {
-				const boost::any &mod = elemType->_fromStr( elem, it->second );
-				////////// COMPILER ERROR   //// Collections must declare an insert method. See documentation for details.
-//				_collection.insert( _collection.end(), *boost::unsafe_any_cast< typename ClassT::value_type >( &mod ) );
-				_collection.insert( _collection.end(), jrtti_cast< typename ClassT::value_type >( mod ) );
+				reader.skip();
 			}
 		}
 		return boost::any();
+	}
+
+	void
+	readElements( ClassT& _collection, Reader& reader ) {
+		Metatype& valueType = Reflector::instance().metatype< typename ClassT::value_type >();
+		reader.beginArray();
+		reserve( _collection, reader.arraySize(), boost::integral_constant< bool, detail::HasReserve< ClassT >::value >() );
+		while ( reader.nextElement() ) {
+			if ( boost::is_pointer< typename ClassT::value_type >::value ) {
+				typename ClassT::value_type elem = typename ClassT::value_type();
+				if ( !reader.readNull() ) {
+					void * address;
+					if ( reader.readPointer( address ) ) {
+						elem = jrtti_cast< typename ClassT::value_type >( boost::any( address ) );
+					}
+					else {
+						elem = readPointerElement( valueType, reader );
+					}
+				}
+				////////// COMPILER ERROR   //// Collections must declare an insert method. See documentation for details.
+				_collection.insert( _collection.end(), elem );
+			}
+			else {
+				readValueElement( _collection, valueType, reader, boost::integral_constant< bool, detail::HasBack< ClassT >::value && detail::HasResize< ClassT >::value >() );
+			}
+		}
+	}
+
+	void
+	reserve( ClassT& _collection, size_t count, boost::true_type ) {
+		if ( count ) {
+			_collection.reserve( _collection.size() + count );
+		}
+	}
+
+	void
+	reserve( ClassT& _collection, size_t count, boost::false_type ) {}
+
+	// sequences read the element in place, at their back
+	void
+	readValueElement( ClassT& _collection, Metatype& valueType, Reader& reader, boost::true_type ) {
+		_collection.resize( _collection.size() + 1 );
+		readValue( _collection.back(), valueType, reader );
+	}
+
+	// other collections read a temporary, moved into the collection
+	void
+	readValueElement( ClassT& _collection, Metatype& valueType, Reader& reader, boost::false_type ) {
+		typename ClassT::value_type elem = typename ClassT::value_type();
+		readValue( elem, valueType, reader );
+		_collection.insert( _collection.end(), boost::move( elem ) );
+	}
+
+	// objects are filled in place. Types read by value, as fundamentals, return it
+	void
+	readValue( typename ClassT::value_type& elem, Metatype& valueType, Reader& reader ) {
+		boost::any value = valueType._read( &elem, reader, false );
+		if ( !value.empty() ) {
+			elem = jrtti_cast< typename ClassT::value_type >( value );
+		}
+	}
+
+	// the element type is given by a __typeInfoName key, written before the other properties
+	// since the serialization plan. Older documents are searched for it
+	typename ClassT::value_type
+	readPointerElement( Metatype& valueType, Reader& reader ) {
+		reader.beginObject();
+		std::string key;
+		bool hasKeys = reader.nextKey( key );
+		if ( hasKeys && key == "$ref" ) {
+			return jrtti_cast< typename ClassT::value_type >( boost::any( readRef( reader ) ) );
+		}
+		size_t id;
+		std::string name;
+		bool hasId = hasKeys && key == "$id";
+		bool numericId = false;
+		if ( hasId ) {
+			numericId = reader.readId( id, name );
+			hasKeys = reader.nextKey( key );
+		}
+		Metatype * elemType = &valueType;
+		std::string typeName;
+		if ( hasKeys && key == "__typeInfoName" ) {
+			elemType = &Reflector::instance().metatype( reader.readString() );
+			hasKeys = reader.nextKey( key );
+		}
+		else if ( hasKeys && !valueType._plan().entries.empty() && valueType._plan().entries.front().isTypeName
+				&& reader.peekMember( "__typeInfoName", typeName ) ) {
+			elemType = &Reflector::instance().metatype( typeName );
+		}
+		boost::any elem = elemType->create();
+		if ( numericId ) {
+			_nameRefMap().add( id, elemType->get_instance_ptr( elem ) );
+		}
+		else if ( hasId ) {
+			_nameRefMap().add( name, elemType->get_instance_ptr( elem ) );
+		}
+		if ( hasKeys ) {
+			elemType->_readMembers( elem, reader, key, false );
+		}
+		return jrtti_cast< typename ClassT::value_type >( elem );
 	}
 
 	virtual
@@ -101,10 +551,9 @@ protected:
 	}
 
 	ClassT&
-	getReference( const boost::any value ) {
+	getReference( const boost::any& value ) {
  		if ( value.type() == typeid( ClassT ) ) {
-			static ClassT ref = boost::any_cast< ClassT >( value );
-			return ref;
+			return *const_cast< ClassT * >( boost::any_cast< ClassT >( &value ) );
 		}
 		if ( value.type() == typeid( ClassT * ) ) {
 			return * boost::any_cast< ClassT * >( value );
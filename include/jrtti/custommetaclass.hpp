@@ -1,6 +1,7 @@
 #ifndef jrtticustommetaclassH
 #define jrtticustommetaclassH
 
+#include <algorithm>
 #include "metatype.hpp"
 
 namespace jrtti {
@@ -10,7 +11,10 @@ class CustomMetaclass : public Metatype
 {
 public:
 	CustomMetaclass( const Annotations& annotations = Annotations() )
-		: Metatype( typeid( ClassT ), annotations ) {}
+		: Metatype( typeid( ClassT ), annotations ),
+		  m_isPOD( -1 ),
+		  m_comparesBytes( false ),
+		  m_layoutGeneration( 0 ) {}
 
 	virtual
 	boost::any
@@ -31,6 +35,56 @@ public:
 #endif
 	}
 
+	bool
+	isPOD() const {
+		checkLayout();
+		return m_isPOD > 0;
+	}
+
+	size_t
+	size() const {
+		return sizeof( ClassT );
+	}
+
+	boost::any
+	clone( const boost::any& instance ) {
+		void * inst = get_instance_ptr( instance );
+		if ( !inst ) {
+			return createAsNullPtr();
+		}
+#ifdef BOOST_NO_IS_ABSTRACT
+		return _clone< IsAbstractT >( inst );
+#else
+		return _clone< ClassT >( inst );
+#endif
+	}
+
+	void
+	destroy( const boost::any& instance ) {
+		// objects held by value or by reference are not owned by the container
+		if ( instance.type() == typeid( ClassT ) || instance.type() == typeid( boost::reference_wrapper< ClassT > ) ) {
+			return;
+		}
+		delete static_cast< ClassT * >( get_instance_ptr( instance ) );
+	}
+
+	void
+	copy( const boost::any& dest, const boost::any& source ) {
+		void * dst = get_instance_ptr( dest );
+		void * src = get_instance_ptr( source );
+		if ( !dst || !src ) {
+			throw NullPtrError( name() );
+		}
+		if ( dst == src ) {
+			return;
+		}
+#ifdef BOOST_NO_IS_ABSTRACT
+		_copy< IsAbstractT >( dst, src );
+#else
+		_copy< ClassT >( dst, src );
+#endif
+	}
+
 	struct detail
 	{
 		template <typename >
@@ -49,6 +103,30 @@ public:
 			typedef R 		result_type;
 			typedef void 	param_type;
 		};
+
+		// disables template argument deduction
+		template < typename T >
+		struct Identity
+		{
+			typedef T type;
+		};
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+		// calls a setter method forwarding its argument, so temporaries are moved into it
+		template < typename SetterT >
+		struct SetterCaller
+		{
+			SetterCaller( SetterT s ) : setter( s ) {}
+
+			template < typename ValueT >
+			void
+			operator()( ClassT * instance, ValueT&& value ) const {
+				( instance->*setter )( std::forward< ValueT >( value ) );
+			}
+
+			SetterT setter;
+		};
+#endif
 	};
 
 	/**
@@ -65,6 +143,7 @@ public:
 		parentMetatype( &parent );
 		PropertyMap& parentProps = parent._properties();
 		_properties().insert( parentProps.begin(), parentProps.end() );
+		propertiesChanged();
 		MethodMap& parentMeth = parent._methods();
 		_methods().insert( parentMeth.begin(), parentMeth.end() );
 		pointerMetatype()->parentMetatype( parent.pointerMetatype() );
@@ -106,7 +185,12 @@ public:
 		typedef typename boost::function< void ( ClassT*, PropT ) >				BoostSetter;
 		typedef typename boost::function< PropT ( ClassT * ) >					BoostGetter;
 
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+		typedef typename detail::template SetterCaller< SetterT >				SetterCallerT;
+		return fillProperty< PropT, BoostSetter, BoostGetter >( name, SetterCallerT( setter ), boost::bind(getter,_1), annotations );
+#else
 		return fillProperty< PropT, BoostSetter, BoostGetter >( name, boost::bind(setter,_1,_2), boost::bind(getter,_1), annotations );
+#endif
 	}
 
 	/**
@@ -151,6 +235,30 @@ public:
 		return fillProperty< PropT, BoostSetter, BoostGetter >(name,  setter, getter, annotations );
 	}
 
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/**
+	 * \brief Declares a property with only a setter accessor method taking an rvalue reference
+	 *
+	 * Declares a property with only a setter method whose parameter is PropT&&.
+	 * Values set through the property are moved into the setter.
+	 * \param name property name
+	 * \param setter the address of the setter method
+	 * \param categories a container with property categories
+	 * \return this for chain calls
+	 */
+	template < typename PropT >
+	CustomMetaclass&
+	property(std::string name,  void ( ClassT::*setter)( PropT&& ), const Annotations& annotations = Annotations() )
+	{
+		typedef typename boost::function< void ( ClassT*, PropT ) >	BoostSetter;
+		typedef typename boost::function< PropT ( ClassT * ) >		BoostGetter;
+		typedef typename detail::template SetterCaller< void ( ClassT::* )( PropT&& ) >	SetterCallerT;
+
+		BoostGetter getter;       //getter empty is used by Property<>::isReadOnly()
+		return fillProperty< PropT, BoostSetter, BoostGetter >(name,  SetterCallerT( setter ), getter, annotations );
+	}
+#endif
+
 	/**
 	 * \brief Declares a property managed by Annotations
 	 *
@@ -223,6 +331,69 @@ public:
 		return fillProperty< PropT, BoostSetter, BoostGetter >(name,  setter, getter, annotations );
 	}
 
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+	/**
+	 * \brief Declares a method
+	 *
+	 * Declares a method with any number of parameters.
+	 * Template parameter ReturnType is the return type of the declared method.
+	 * If method returns void, simply note void in template speciallization.
+	 * Template parameters Params are the types of the parameters
+	 * \param name the method name
+	 * \param f the method functor
+	 * \return this for chain call
+	 */
+	template < typename ReturnType, typename... Params >
+	CustomMetaclass&
+	method( std::string name, typename detail::template Identity< boost::function< ReturnType ( ClassT*, Params... ) > >::type f, const Annotations& annotations = Annotations() )
+	{
+		typedef TypedMethod< ClassT, ReturnType, Params... > MethodType;
+		typedef typename boost::function< ReturnType ( ClassT*, Params... ) > FunctionType;
+
+		return fillMethod< MethodType, FunctionType >( name, f, annotations );
+	}
+
+	/**
+	 * \brief Declares a method from its address
+	 *
+	 * Declares a method deducing its signature from the method address.
+	 * \param name the method name
+	 * \param f address of the method
+	 * \return this for chain call
+	 */
+	template < typename ReturnType, typename... Params >
+	CustomMetaclass&
+	method( std::string name, ReturnType ( ClassT::*f )( Params... ), const Annotations& annotations = Annotations() )
+	{
+		typedef TypedMethod< ClassT, ReturnType, Params... > MethodType;
+		typedef typename boost::function< ReturnType ( ClassT*, Params... ) > FunctionType;
+
+		return fillMethod< MethodType, FunctionType >( name, f, annotations );
+	}
+
+	template < typename ReturnType, typename... Params >
+	CustomMetaclass&
+	method( std::string name, ReturnType ( ClassT::*f )( Params... ) const, const Annotations& annotations = Annotations() )
+	{
+		typedef TypedMethod< ClassT, ReturnType, Params... > MethodType;
+		typedef typename boost::function< ReturnType ( ClassT*, Params... ) > FunctionType;
+
+		return fillMethod< MethodType, FunctionType >( name, f, annotations );
+	}
+
+	/**
+	 * Returns the typed method
+	 * \param name the method name to look for
+	 * \return the typed method abstraction
+	 */
+	template < typename ReturnType, typename... Params >
+	TypedMethod< ClassT, ReturnType, Params... >&
+	getMethod(std::string name)
+	{
+		typedef TypedMethod< ClassT, ReturnType, Params... > ElementType;
+		return * static_cast< ElementType * >( &signedMethod( name, typeid( ReturnType ( Params... ) ) ) );
+	}
+#else
 	/**
 	 * \brief Declares a method without parameters
 	 *
@@ -296,8 +467,9 @@ public:
 	getMethod(std::string name)
 	{
 		typedef TypedMethod< ClassT, ReturnType, Param1, Param2 > ElementType;
-		return * static_cast< ElementType * >( m_methods[name] );
+		return * static_cast< ElementType * >( &method( name ) );
 	}
+#endif
 
 protected:
 	void *
@@ -332,7 +504,64 @@ protected:
 		return ( ClassT * )0;
 	}
 
+protected:
+	bool
+	_comparesBytes() const {
+		checkLayout();
+		return m_comparesBytes;
+	}
+
 private:
+	// layout flags depend on the properties of member types too, so they are
+	// recomputed when the properties of any metatype change
+	void
+	checkLayout() const {
+		if ( m_isPOD < 0 || m_layoutGeneration != _propertiesGeneration() ) {
+			m_layoutGeneration = _propertiesGeneration();
+			m_isPOD = const_cast< CustomMetaclass * >( this )->checkPOD();
+		}
+	}
+
+	// returns 1 if POD, 0 if not and -1 if it can not be decided until pending properties are resolved.
+	// Sets m_comparesBytes
+	int
+	checkPOD() {
+		m_comparesBytes = false;
+		if ( isAbstract() || !is_trivially_copyable< ClassT >::value || _properties().empty() ) {
+			return 0;
+		}
+		bool comparesBytes = true;
+		std::vector< std::pair< size_t, size_t > > ranges;
+		for ( PropertyMap::iterator it = _properties().begin(); it != _properties().end(); ++it ) {
+			Property * prop = it->second;
+			if ( !prop->isDataMember() ) {
+				return 0;
+			}
+			if ( prop->isPending() ) {
+				return -1;
+			}
+			if ( !prop->metatype().isPOD() ) {
+				return 0;
+			}
+			comparesBytes = comparesBytes && prop->metatype()._comparesBytes();
+			ranges.push_back( std::make_pair( prop->offset(), prop->size() ) );
+		}
+		// every byte has to be described by a single property
+		std::sort( ranges.begin(), ranges.end() );
+		size_t described = 0;
+		for ( std::vector< std::pair< size_t, size_t > >::iterator it = ranges.begin(); it != ranges.end(); ++it ) {
+			if ( it->first != described ) {
+				return 0;
+			}
+			described += it->second;
+		}
+		if ( described != sizeof( ClassT ) ) {
+			return 0;
+		}
+		m_comparesBytes = comparesBytes;
+		return 1;
+	}
+
 	template <typename MethodType, typename FunctionType>
 	CustomMetaclass&
 	fillMethod( std::string name, FunctionType function, const Annotations& annotations )
@@ -372,9 +601,8 @@ private:
 	typename boost::disable_if< typename __IS_ABSTRACT( AbstT ), void * >::type
 	_get_instance_ptr(const boost::any& content){
 		if ( content.type() == typeid( ClassT ) ) {
-			static ClassT dummy = ClassT();
-			dummy = boost::any_cast< ClassT >(content);
-			return &dummy;
+			// objects held by value are accessed in place. Pointer is valid while content lives
+			return const_cast< ClassT * >( boost::any_cast< ClassT >( &content ) );
 		}
 		if ( content.type() == typeid( boost::reference_wrapper< ClassT > ) ) {
 			return boost::any_cast< boost::reference_wrapper< ClassT > >( content ).get_pointer();
@@ -406,6 +634,39 @@ private:
 		return boost::any();
 	}
 
+//SFINAE _clone for NON ABSTRACT
+	template< typename AbstT >
+	typename boost::disable_if< typename __IS_ABSTRACT( AbstT ), boost::any >::type
+	_clone( void * inst ){
+		return new ClassT( *static_cast< ClassT * >( inst ) );
+	}
+
+//SFINAE _clone for ABSTRACT
+	template< typename AbstT >
+	typename boost::enable_if< typename __IS_ABSTRACT( AbstT ), boost::any >::type
+	_clone( void * inst ){
+		return boost::any();
+	}
+
+//SFINAE _copy for NON ABSTRACT
+	template< typename AbstT >
+	typename boost::disable_if< typename __IS_ABSTRACT( AbstT ), void >::type
+	_copy( void * dst, void * src ){
+		if ( isPOD() ) {
+			memcpy( dst, src, sizeof( ClassT ) );
+		}
+		else {
+			*static_cast< ClassT * >( dst ) = *static_cast< ClassT * >( src );
+		}
+	}
+
+//SFINAE _copy for ABSTRACT
+	template< typename AbstT >
+	typename boost::enable_if< typename __IS_ABSTRACT( AbstT ), void >::type
+	_copy( void * dst, void * src ){
+		throw Error( "Can not copy abstract class '" + name() + "'" );
+	}
+
 //SFINAE _create for NON ABSTRACT
 	template< typename AbstT >
 	typename boost::disable_if< typename __IS_ABSTRACT( AbstT ), boost::any >::type
@@ -421,6 +682,9 @@ private:
 	{
 		return boost::any();
 	}
+	mutable int		m_isPOD;
+	mutable bool	m_comparesBytes;	///< POD without floating point members
+	mutable unsigned	m_layoutGeneration;	///< properties generation of the layout flags
 };
 
 }; //namespace jrtti
@@ -0,0 +1,248 @@
+#ifndef jrttidispatcherH
+#define jrttidispatcherH
+
+#include <vector>
+#include <map>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Reflective command dispatcher
+ *
+ * Invokes methods on objects through the Metatype method table. Methods are
+ * resolved once per (type, method) pair into a dispatch table together with
+ * the decoders of their arguments. Further commands address the method by its
+ * MethodId, avoiding any name lookup.
+ *
+ * Arguments are given already typed, as a boost::any array, or as a JSON
+ * array. Commands carry JSON arguments.
+ * JSON arguments of fundamental and string types are decoded by value. Objects
+ * are decoded into a temporary instance destroyed after the call, except when
+ * the parameter is a pointer. In such case the created object is passed to the
+ * invoked method, and is only destroyed if the call does not return normally.
+ *
+ * Decoding state is local to each call, so invoked methods can dispatch again.
+ * Once all the methods are resolved, several threads can dispatch at once.
+ */
+class Dispatcher {
+public:
+	typedef size_t MethodId;
+
+	/**
+	 * \brief A command to be dispatched
+	 */
+	struct Command {
+		Command()
+			: method( 0 )
+		{}
+
+		Command( MethodId pmethod, const boost::any& pinstance, const std::string& parguments )
+			: method( pmethod ),
+			  instance( pinstance ),
+			  arguments( parguments )
+		{}
+
+		MethodId	method;		///< the method to invoke as returned by Dispatcher::resolve
+		boost::any	instance;	///< the object where the method will be invoked
+		std::string	arguments;	///< the method arguments as a JSON array
+	};
+
+	/**
+	 * \brief Resolves a method into the dispatch table
+	 *
+	 * Resolving an already resolved method returns the cached id.
+	 * \param type the metatype declaring the method
+	 * \param methodName the method name
+	 * \return the method id to use in dispatch calls
+	 * \throw Error if method is not declared or any parameter type is not declared
+	 */
+	MethodId
+	resolve( Metatype& type, const std::string& methodName ) {
+		std::string key = type.name() + "::" + methodName;
+		IdMap::iterator it = m_ids.find( key );
+		if ( it != m_ids.end() ) {
+			return it->second;
+		}
+
+		Entry entry;
+		entry.type = &type;
+		entry.method = &type.method( methodName );
+		for ( size_t i = 0; i < entry.method->arity(); ++i ) {
+			entry.decoders.push_back( &jrtti::metatype( entry.method->parameterType( i ) ) );
+		}
+		m_table.push_back( entry );
+		return m_ids[ key ] = m_table.size() - 1;
+	}
+
+	/**
+	 * \brief Resolves a method into the dispatch table
+	 * \param typeName the demangled name of the type declaring the method
+	 * \param methodName the method name
+	 * \return the method id to use in dispatch calls
+	 * \throw Error if type or method are not declared
+	 */
+	MethodId
+	resolve( const std::string& typeName, const std::string& methodName ) {
+		IdMap::iterator it = m_ids.find( typeName + "::" + methodName );
+		if ( it != m_ids.end() ) {
+			return it->second;
+		}
+		return resolve( findType( typeName ), methodName );
+	}
+
+	/**
+	 * \brief Returns the method of a resolved method id
+	 * \param id the method id
+	 * \return the method abstraction
+	 */
+	Method&
+	method( MethodId id ) {
+		return *entry( id ).method;
+	}
+
+	/**
+	 * \brief Invokes a resolved method with already typed arguments
+	 * \param id the method id
+	 * \param instance the object where the method will be invoked
+	 * \param args array of arguments
+	 * \param count number of arguments
+	 * \return the call result. Empty if method returns void
+	 */
+	boost::any
+	dispatch( MethodId id, const boost::any& instance, const boost::any * args, size_t count ) {
+		Entry& e = entry( id );
+		return e.method->invoke( e.type->get_instance_ptr( instance ), args, count );
+	}
+
+	/**
+	 * \brief Invokes a resolved method with JSON encoded arguments
+	 * \param id the method id
+	 * \param instance the object where the method will be invoked
+	 * \param arguments the method arguments as a JSON array. ex: [ 2, "text", { "x": 1 } ]
+	 * \return the call result. Empty if method returns void
+	 * \throw Error if the number of arguments is not the method arity
+	 */
+	boost::any
+	dispatch( MethodId id, const boost::any& instance, const std::string& arguments ) {
+		Entry& e = entry( id );
+		size_t count = e.decoders.size();
+		Arguments args( count );
+
+		JSONReader reader( arguments );
+		reader.beginArray();
+		for ( size_t i = 0; i < count; ++i ) {
+			if ( !reader.nextElement() ) {
+				throw Error( "Method '" + e.method->name() + "' expects " + numToStr( count ) + " arguments" );
+			}
+			args.values[ i ] = decode( *e.decoders[ i ], reader, args );
+		}
+		if ( reader.nextElement() ) {
+			throw Error( "Method '" + e.method->name() + "' expects " + numToStr( count ) + " arguments" );
+		}
+		boost::any result = e.method->invoke( e.type->get_instance_ptr( instance ), count ? &args.values[ 0 ] : NULL, count );
+		args.transferred.clear();
+		return result;
+	}
+
+	/**
+	 * \brief Invokes a command
+	 * \param command the command to dispatch
+	 * \return the call result. Empty if method returns void
+	 */
+	boost::any
+	dispatch( const Command& command ) {
+		return dispatch( command.method, command.instance, command.arguments );
+	}
+
+	/**
+	 * \brief Invokes a batch of commands
+	 *
+	 * Commands are invoked in order.
+	 * \param commands the commands to dispatch
+	 * \param results receives the result of each command in the same order
+	 */
+	void
+	dispatch( const std::vector< Command >& commands, std::vector< boost::any >& results ) {
+		results.resize( commands.size() );
+		for ( size_t i = 0; i < commands.size(); ++i ) {
+			results[ i ] = dispatch( commands[ i ] );
+		}
+	}
+
+private:
+	struct Entry {
+		Metatype *					type;
+		Method *					method;
+		std::vector< Metatype * >	decoders;
+	};
+
+	typedef std::map< std::string, MethodId > IdMap;
+
+	typedef std::vector< std::pair< Metatype *, boost::any > > Objects;
+
+	// decoded arguments of a call. Objects decoded by value are destroyed with
+	// it, and objects passed by pointer unless the call returned normally
+	struct Arguments {
+		Arguments( size_t count )
+			: values( count )
+		{}
+
+		~Arguments() {
+			destroy( owned );
+			destroy( transferred );
+		}
+
+		static
+		void
+		destroy( Objects& objects ) {
+			for ( size_t i = 0; i < objects.size(); ++i ) {
+				objects[ i ].first->destroy( objects[ i ].second );
+			}
+		}
+
+		std::vector< boost::any >	values;
+		Objects						owned;
+		Objects						transferred;	///< cleared once the method returned
+	};
+
+	Entry&
+	entry( MethodId id ) {
+		if ( id >= m_table.size() ) {
+			throw Error( "Method id " + numToStr( id ) + " not resolved" );
+		}
+		return m_table[ id ];
+	}
+
+	Metatype&
+	findType( const std::string& typeName ) {
+		for ( TypeMap::const_iterator it = metatypes().begin(); it != metatypes().end(); ++it ) {
+			if ( it->second->name() == typeName ) {
+				return *it->second;
+			}
+		}
+		throw Error( "Metatype '" + typeName + "' not declared" );
+	}
+
+	// references inside an argument resolve through the reference map of an
+	// enclosing deserialization, if any, which is kept
+	boost::any
+	decode( Metatype& mt, Reader& reader, Arguments& args ) {
+		if ( mt.isFundamental() || mt.typeInfo() == typeid( std::string ) ) {
+			return mt._read( boost::any(), reader );
+		}
+		if ( mt.isPointer() && reader.readNull() ) {
+			return mt.createAsNullPtr();
+		}
+		boost::any instance = mt.create();
+		( mt.isPointer() ? args.transferred : args.owned ).push_back( std::make_pair( &mt, instance ) );
+		mt._read( instance, reader, false );
+		return instance;
+	}
+
+	std::vector< Entry >	m_table;
+	IdMap					m_ids;
+};
+
+}; //namespace jrtti
+#endif  //jrttidispatcherH
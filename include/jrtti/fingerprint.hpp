@@ -0,0 +1,147 @@
+#ifndef jrttifingerprintH
+#define jrttifingerprintH
+
+#include <map>
+#include <string>
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+namespace jrtti {
+
+/**
+ * \brief Streaming 64-bit hash of object graphs
+ *
+ * Accumulates raw values into a fast non-cryptographic 64-bit hash, and keeps
+ * the visit order of the objects already hashed so references to them are
+ * hashed by order instead of being walked again.
+ *
+ * Fingerprints are suitable to detect changes and to key caches. They depend
+ * on the platform byte order and type sizes, so they should not be compared
+ * across platforms.
+ * See Metatype::fingerprint
+ */
+class Fingerprint {
+public:
+	typedef boost::uint64_t Value;
+
+	Fingerprint()
+		: m_hash( UINT64_C( 0x9e3779b97f4a7c15 ) ),
+		  m_length( 0 )
+	{}
+
+	/**
+	 * \brief Adds raw bytes to the hash
+	 * \param data address of the bytes
+	 * \param length number of bytes
+	 */
+	void
+	update( const void * data, size_t length ) {
+		const unsigned char * p = static_cast< const unsigned char * >( data );
+		m_length += length;
+		for ( ; length >= sizeof( Value ); p += sizeof( Value ), length -= sizeof( Value ) ) {
+			Value block;
+			memcpy( &block, p, sizeof( Value ) );
+			mixIn( block );
+		}
+		if ( length ) {
+			Value block = 0;
+			memcpy( &block, p, length );
+			mixIn( block ^ ( Value( length ) << 56 ) );
+		}
+	}
+
+	/**
+	 * \brief Adds the bytes of a fundamental value to the hash
+	 * \param value the value
+	 */
+	template< typename T >
+	void
+	update( const T& value ) {
+		update( &value, sizeof( T ) );
+	}
+
+	/**
+	 * \brief Adds a long double value to the hash
+	 *
+	 * Hashed as two doubles, as long double objects may contain padding bytes.
+	 * \param value the value
+	 */
+	void
+	update( long double value ) {
+		double high = static_cast< double >( value );
+		update( high );
+		update( static_cast< double >( value - high ) );
+	}
+
+	/**
+	 * \brief Adds a string and its length to the hash
+	 * \param str the string
+	 */
+	void
+	update( const std::string& str ) {
+		update( str.length() );
+		update( str.data(), str.length() );
+	}
+
+	/**
+	 * \brief Registers an object as visited
+	 * \param address the object address
+	 */
+	void
+	visit( void * address ) {
+		m_visited.insert( VisitMap::value_type( address, m_visited.size() ) );
+	}
+
+	/**
+	 * \brief Looks for an already visited object
+	 * \param address the object address
+	 * \param order receives the visit order of the object if found
+	 * \return true if the object was already visited
+	 */
+	bool
+	visited( void * address, size_t& order ) const {
+		VisitMap::const_iterator it = m_visited.find( address );
+		if ( it == m_visited.end() ) {
+			return false;
+		}
+		order = it->second;
+		return true;
+	}
+
+	/**
+	 * \brief The fingerprint of the data added so far
+	 * \return the 64-bit hash value
+	 */
+	Value
+	value() const {
+		return mix( m_hash ^ m_length );
+	}
+
+private:
+	typedef std::map< void *, size_t > VisitMap;
+
+	static
+	Value
+	mix( Value k ) {
+		k ^= k >> 33;
+		k *= UINT64_C( 0xff51afd7ed558ccd );
+		k ^= k >> 33;
+		k *= UINT64_C( 0xc4ceb9fe1a85ec53 );
+		k ^= k >> 33;
+		return k;
+	}
+
+	void
+	mixIn( Value block ) {
+		m_hash ^= mix( block );
+		m_hash = ( ( m_hash << 27 ) | ( m_hash >> 37 ) ) * UINT64_C( 0x9fb21c651e98df25 ) + UINT64_C( 0x165667b19e3779f9 );
+	}
+
+	Value		m_hash;
+	Value		m_length;
+	VisitMap	m_visited;
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttifingerprintH
@@ -0,0 +1,419 @@
+#ifndef jrttiformatH
+#define jrttiformatH
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+namespace jrtti {
+
+class Metatype;
+
+/**
+ * \brief Output side of a serialization format
+ *
+ * Metatype::write walks the object graph, resolving references, annotations,
+ * collections and polymorphism, and reports the values found as typed events
+ * to a Writer. A Writer only decides how those values are encoded.
+ *
+ * Objects are written as beginObject, an optional writeId, a sequence of key
+ * or field followed by its value, and endObject. Arrays are written as
+ * beginArray, the values of the elements, and endArray.
+ */
+class Writer {
+public:
+	virtual
+	~Writer() {}
+
+	/**
+	 * \brief Starts an object
+	 */
+	virtual
+	void
+	beginObject() = 0;
+
+	/**
+	 * \brief Writes the id of the current object
+	 *
+	 * Only called for streaming, just after beginObject.
+	 * \param id the id other objects use to reference this one
+	 */
+	virtual
+	void
+	writeId( const std::string& id ) = 0;
+
+	/**
+	 * \brief Starts an object member
+	 * \param name the property name. The next value written is its value
+	 */
+	virtual
+	void
+	key( const std::string& name ) = 0;
+
+	/**
+	 * \brief Starts an object member identified by a field id
+	 *
+	 * Called for the properties of objects. Formats keyed by name ignore the
+	 * id, which is the default.
+	 * \param name the property name
+	 * \param id the field id of the property. 0 if the property has no id
+	 */
+	virtual
+	void
+	field( const std::string& name, boost::uint32_t id ) {
+		key( name );
+	}
+
+	/**
+	 * \brief Starts an object member whose name is already encoded
+	 *
+	 * Called for the properties of objects, with the name encoded once per
+	 * property. Text formats append the encoded name instead of escaping the
+	 * name again. The default calls field.
+	 * \param name the property name
+	 * \param id the field id of the property. 0 if the property has no id
+	 * \param jsonName the name quoted and escaped as a JSON string
+	 */
+	virtual
+	void
+	encodedField( const std::string& name, boost::uint32_t id, const std::string& jsonName ) {
+		field( name, id );
+	}
+
+	/**
+	 * \brief Starts an object member whose field id is derived from its name
+	 *
+	 * Ids derived from different names may collide. Formats keyed by id can
+	 * store the name of the id, so readers with another schema check it. The
+	 * default calls encodedField.
+	 * \param type the name of the type declaring the property. The same
+	 * string object is passed for every member of the type
+	 * \param name the property name
+	 * \param id the field id derived from name
+	 * \param jsonName the name quoted and escaped as a JSON string
+	 */
+	virtual
+	void
+	derivedField( const std::string& type, const std::string& name, boost::uint32_t id, const std::string& jsonName ) {
+		encodedField( name, id, jsonName );
+	}
+
+	/**
+	 * \brief Ends the current object
+	 */
+	virtual
+	void
+	endObject() = 0;
+
+	/**
+	 * \brief Starts an array
+	 * \param count number of elements that will be written
+	 */
+	virtual
+	void
+	beginArray( size_t count ) = 0;
+
+	/**
+	 * \brief Ends the current array
+	 */
+	virtual
+	void
+	endArray() = 0;
+
+	/**
+	 * \brief Writes a reference to an already written object
+	 * \param id the id given to the referenced object
+	 */
+	virtual
+	void
+	writeRef( const std::string& id ) = 0;
+
+	/**
+	 * \brief Writes a null pointer
+	 */
+	virtual
+	void
+	writeNull() = 0;
+
+	/**
+	 * \brief Writes a non null pointer by itself
+	 *
+	 * Formats storing the pointed objects apart write a reference to the
+	 * object and return true. Otherwise the object is written in place or as
+	 * a reference to where it was written before, which is the default.
+	 * \param address the pointed object
+	 * \param type the metatype of the pointed object
+	 * \return true if the pointer was written
+	 */
+	virtual
+	bool
+	writePointer( void * address, Metatype& type ) {
+		return false;
+	}
+
+	virtual
+	void
+	writeBool( bool value ) = 0;
+
+	virtual
+	void
+	writeChar( char value ) {
+		writeInt( value );
+	}
+
+	virtual
+	void
+	writeInt( boost::int64_t value ) = 0;
+
+	virtual
+	void
+	writeFloat( float value ) {
+		writeDouble( value );
+	}
+
+	virtual
+	void
+	writeDouble( double value ) = 0;
+
+	virtual
+	void
+	writeLongDouble( long double value ) {
+		writeDouble( static_cast< double >( value ) );
+	}
+
+	virtual
+	void
+	writeString( const std::string& value ) = 0;
+
+	/**
+	 * \brief Writes the value of a __typeInfoName property
+	 *
+	 * Type names repeat across the elements of collections, so formats may
+	 * store them once. It is read back with Reader::readString, and written
+	 * as a string by default.
+	 * \param name the type name
+	 */
+	virtual
+	void
+	writeTypeName( const std::string& name ) {
+		writeString( name );
+	}
+
+	/**
+	 * \brief Writes the JSON text returned by a StringifyDelegate
+	 *
+	 * By default it is written as a string.
+	 * \param json the text returned by StringifyDelegateBase::toStr
+	 */
+	virtual
+	void
+	writeStringified( const std::string& json ) {
+		writeString( json );
+	}
+};
+
+/**
+ * \brief Input side of a serialization format
+ *
+ * Metatype::read pulls the values of the object graph from a Reader, in the
+ * same order they were reported to the Writer of the format. Object ids and
+ * references are reported as the "$id" and "$ref" keys, whose values are
+ * read with readId.
+ */
+class Reader {
+public:
+	virtual
+	~Reader() {}
+
+	/**
+	 * \brief Consumes a null pointer
+	 * \return true if next value was a null pointer. Otherwise nothing is consumed
+	 */
+	virtual
+	bool
+	readNull() = 0;
+
+	/**
+	 * \brief Consumes the start of an object
+	 * \throw Error if next value is not an object
+	 */
+	virtual
+	void
+	beginObject() = 0;
+
+	/**
+	 * \brief Reads the next key of the current object
+	 * \param key receives the key. Its value must be read or skipped next
+	 * \return false when the end of the object was reached and consumed
+	 */
+	virtual
+	bool
+	nextKey( std::string& key ) = 0;
+
+	/**
+	 * \brief Field id of the last key read
+	 *
+	 * Formats identifying properties by field id report an empty key and
+	 * return its id here.
+	 * \return the field id, or 0 if the key is a name
+	 */
+	virtual
+	boost::uint32_t
+	fieldId() const {
+		return 0;
+	}
+
+	/**
+	 * \brief Checks the property matched by the field id of the last key
+	 *
+	 * Called for ids derived from names, which may collide. Formats storing
+	 * the names of the ids compare them. The default accepts the property.
+	 * \param type the name of the type declaring the property. The same
+	 * string object is passed for every member of the type
+	 * \param name the property name
+	 * \return false if the field was written for another property
+	 */
+	virtual
+	bool
+	matchesField( const std::string& type, const std::string& name ) {
+		return true;
+	}
+
+	/**
+	 * \brief Consumes the start of an array
+	 * \throw Error if next value is not an array
+	 */
+	virtual
+	void
+	beginArray() = 0;
+
+	/**
+	 * \brief Number of elements of the array just begun
+	 *
+	 * Called after beginArray, before the first nextElement. Used to reserve
+	 * room for the elements.
+	 * \return the element count, or 0 if the format does not know it
+	 */
+	virtual
+	size_t
+	arraySize() const {
+		return 0;
+	}
+
+	/**
+	 * \brief Moves to the next element of the current array
+	 * \return false when the end of the array was reached and consumed
+	 */
+	virtual
+	bool
+	nextElement() = 0;
+
+	/**
+	 * \brief Reads a non null pointer written by Writer::writePointer
+	 * \param address receives the pointed object
+	 * \return true if the pointer was read. By default false, and the object
+	 * is read in place
+	 */
+	virtual
+	bool
+	readPointer( void *& address ) {
+		return false;
+	}
+
+	virtual
+	bool
+	readBool() = 0;
+
+	virtual
+	char
+	readChar() {
+		return static_cast< char >( readInt() );
+	}
+
+	virtual
+	boost::int64_t
+	readInt() = 0;
+
+	virtual
+	double
+	readDouble() = 0;
+
+	virtual
+	long double
+	readLongDouble() {
+		return readDouble();
+	}
+
+	virtual
+	std::string
+	readString() = 0;
+
+	/**
+	 * \brief Reads the value of a "$id" or "$ref" key
+	 *
+	 * By default the id is read with readString and converted if it is a
+	 * decimal number.
+	 * \param id receives the id if it is an integer
+	 * \param name receives the id otherwise
+	 * \return true if the id is an integer
+	 */
+	virtual
+	bool
+	readId( size_t& id, std::string& name ) {
+		name = readString();
+		if ( name.empty() || name.length() > 18 ) {
+			return false;
+		}
+		id = 0;
+		for ( std::string::const_iterator c = name.begin(); c != name.end(); ++c ) {
+			if ( *c < '0' || *c > '9' ) {
+				return false;
+			}
+			id = id * 10 + size_t( *c - '0' );
+		}
+		return true;
+	}
+
+	/**
+	 * \brief Reads a value written with Writer::writeStringified
+	 *
+	 * Returns the text as StringifyDelegateBase::fromStr expects it: JSON
+	 * strings come without their quotes.
+	 * \return the stringified value
+	 */
+	virtual
+	std::string
+	readStringified() {
+		std::string str = readString();
+		if ( str.length() > 1 && str[ 0 ] == '"' && str[ str.length() - 1 ] == '"' ) {
+			return str.substr( 1, str.length() - 2 );
+		}
+		return str;
+	}
+
+	/**
+	 * \brief Skips the next value, whatever its type
+	 */
+	virtual
+	void
+	skip() = 0;
+
+	/**
+	 * \brief Finds a string member of the current object without consuming it
+	 *
+	 * Called with the value of the last key read still pending, for keys that
+	 * documents of previous versions did not write first. The default finds
+	 * nothing, as formats with no previous versions write them first.
+	 * \param key the key of the member
+	 * \param value receives the value of the member
+	 * \return true if the member was found
+	 */
+	virtual
+	bool
+	peekMember( const std::string& key, std::string& value ) {
+		return false;
+	}
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttiformatH
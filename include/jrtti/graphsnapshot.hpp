@@ -0,0 +1,252 @@
+#ifndef jrttigraphsnapshotH
+#define jrttigraphsnapshotH
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "jrtti.hpp"
+#include "binaryformat.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Snapshot of a whole object graph as relocatable records
+ *
+ * Every object reached through pointers is stored once, as a record holding
+ * its properties in the binary format of Metatype::toBinary. Pointers are
+ * stored as the index of the record they point to, so records never nest and
+ * cycles need no special handling.
+ *
+ * The data starts with a header holding the signature, the schema
+ * fingerprint of the root metatype and the offset of the directory. The
+ * records follow, the root first, and the directory closes the data with the
+ * type of each record and the string table of the records.
+ *
+ * Loading creates all the objects from the directory first, and then fills
+ * the records in a single linear pass, resolving pointers by index. No
+ * object ids are formatted or looked up, and the load does not recurse
+ * through the pointers of the graph, however long its chains are.
+ *
+ * Record types are stored by their compiler type names, so snapshots are
+ * not portable across toolchains.
+ */
+class GraphSnapshot {
+public:
+	/**
+	 * \brief Stores the graph reachable from an object
+	 * \param mt the metatype of the root object
+	 * \param root the root object
+	 * \return the snapshot data
+	 */
+	static
+	std::string
+	save( Metatype& mt, const boost::any& root ) {
+		RecordWriter writer( mt.schemaFingerprint() );
+		writer.record( mt.get_instance_ptr( root ), mt );
+		for ( size_t i = 0; i < writer.records.size(); ++i ) {
+			Record record = writer.records[ i ];
+			record.type->write( record.address, writer, true );
+		}
+		return writer.finish();
+	}
+
+	/**
+	 * \brief Loads a graph stored by save
+	 *
+	 * The root object is filled in place. The other objects are created and
+	 * owned by the graph. If loading fails they are destroyed, and the root
+	 * object may be left partially filled, pointing to them.
+	 * \param mt the metatype of the root object
+	 * \param root the root object to fill
+	 * \param data the snapshot data
+	 * \throw Error if data is not a graph snapshot of mt, or is truncated
+	 */
+	static
+	void
+	load( Metatype& mt, const boost::any& root, const std::string& data ) {
+		RecordReader reader( data );
+		if ( reader.schemaFingerprint() != mt.schemaFingerprint() ) {
+			throw Error( "Graph snapshot: schema does not match '" + mt.name() + "'" );
+		}
+		std::vector< Record >& records = reader.records;
+		if ( records.empty() ) {
+			throw Error( "Graph snapshot: no root record" );
+		}
+		records[ 0 ].address = mt.get_instance_ptr( root );
+		records[ 0 ].type = &mt;
+		std::vector< boost::any > created;
+		created.reserve( records.size() );
+		try {
+			for ( size_t i = 1; i < records.size(); ++i ) {
+				created.push_back( records[ i ].type->create() );
+				records[ i ].address = records[ i ].type->get_instance_ptr( created.back() );
+				if ( !records[ i ].address ) {
+					throw Error( "Graph snapshot: can not create '" + records[ i ].type->name() + "'" );
+				}
+			}
+			for ( size_t i = 0; i < records.size(); ++i ) {
+				reader.nextRecord();
+				records[ i ].type->read( records[ i ].address, reader );
+			}
+		}
+		catch ( ... ) {
+			for ( size_t i = 0; i < created.size(); ++i ) {
+				records[ i + 1 ].type->destroy( created[ i ] );
+			}
+			throw;
+		}
+	}
+
+private:
+	static const size_t headerSize = 20;
+
+	static
+	const char *
+	signature() {
+		return "jrg\x02";
+	}
+
+	struct Record {
+		Record( void * paddress, Metatype * ptype )
+			: address( paddress ),
+			  type( ptype )
+		{}
+
+		void *		address;
+		Metatype *	type;
+	};
+
+	class RecordWriter : public BinaryWriter {
+	public:
+		RecordWriter( boost::uint64_t schemaFingerprint ) {
+			m_buf.append( signature(), BinaryFormat::signatureLength );
+			appendLittleEndian( schemaFingerprint, 8 );
+			appendLittleEndian( 0, 8 );
+		}
+
+		// objects are identified by their record
+		void
+		writeId( const std::string& id ) {}
+
+		bool
+		writePointer( void * address, Metatype& type ) {
+			header( BinaryFormat::Varint );
+			appendVarint( m_buf, record( address, type ) );
+			return true;
+		}
+
+		// index of the record of the object at address, added if new
+		size_t
+		record( void * address, Metatype& type ) {
+			Metatype * dynamicType = &type;
+			Metatype::PropertyMap::const_iterator typeName = type.properties().find( "__typeInfoName" );
+			if ( typeName != type.properties().end() ) {
+				dynamicType = &Reflector::instance().metatype( typeName->second->get< std::string >( address ) );
+			}
+			std::pair< IndexMap::iterator, bool > inserted = m_indexes.insert( std::make_pair( ObjectKey( address, dynamicType ), records.size() ) );
+			if ( inserted.second ) {
+				records.push_back( Record( address, dynamicType ) );
+			}
+			return inserted.first->second;
+		}
+
+		// appends the directory and returns the data
+		const std::string&
+		finish() {
+			size_t directory = m_buf.size();
+			std::map< Metatype *, size_t > typeIndexes;
+			std::vector< Metatype * > types;
+			std::string recordTypes;
+			for ( std::vector< Record >::iterator it = records.begin(); it != records.end(); ++it ) {
+				std::map< Metatype *, size_t >::iterator found = typeIndexes.find( it->type );
+				if ( found == typeIndexes.end() ) {
+					found = typeIndexes.insert( std::make_pair( it->type, types.size() ) ).first;
+					types.push_back( it->type );
+				}
+				appendVarint( recordTypes, found->second );
+			}
+			appendVarint( m_buf, types.size() );
+			for ( std::vector< Metatype * >::iterator it = types.begin(); it != types.end(); ++it ) {
+				std::string name = ( *it )->typeInfo().name();
+				appendVarint( m_buf, name.length() );
+				m_buf += name;
+			}
+			appendVarint( m_buf, records.size() );
+			m_buf += recordTypes;
+			appendStringTable();
+			for ( int i = 0; i < 8; ++i ) {
+				m_buf[ headerSize - 8 + i ] = char( boost::uint64_t( directory ) >> ( i * 8 ) );
+			}
+			return m_buf;
+		}
+
+		std::vector< Record >	records;
+
+	private:
+		// objects are identified by address and type, as a member may share the address of its owner
+		typedef std::pair< void *, Metatype * >	ObjectKey;
+		typedef std::map< ObjectKey, size_t >	IndexMap;
+
+		IndexMap	m_indexes;
+	};
+
+	class RecordReader : public BinaryReader {
+	public:
+		RecordReader( const std::string& data )
+			: BinaryReader( data, 0 )
+		{
+			if ( m_data.compare( 0, BinaryFormat::signatureLength, signature() ) != 0 ) {
+				throw Error( "Graph snapshot: data is not a graph snapshot" );
+			}
+			m_pos = BinaryFormat::signatureLength;
+			m_schemaFingerprint = littleEndian( 8 );
+			size_t directory = size_t( littleEndian( 8 ) );
+			if ( directory < headerSize || directory > m_data.length() ) {
+				throw Error( "Graph snapshot: unexpected end of data" );
+			}
+
+			m_pos = directory;
+			// names take one byte at least, so corrupted counts do not reserve huge arrays
+			boost::uint64_t typeCount = readVarint();
+			std::vector< Metatype * > types;
+			types.reserve( size_t( std::min( typeCount, boost::uint64_t( m_data.length() - m_pos ) ) ) );
+			for ( boost::uint64_t i = 0; i < typeCount; ++i ) {
+				types.push_back( &Reflector::instance().metatype( readBytes() ) );
+			}
+			size_t count = size_t( readVarint() );
+			for ( size_t i = 0; i < count; ++i ) {
+				size_t type = size_t( readVarint() );
+				if ( type >= types.size() ) {
+					throw mismatch( "type index" );
+				}
+				records.push_back( Record( NULL, types[ type ] ) );
+			}
+			readStringTable();
+			m_pos = headerSize;
+		}
+
+		void
+		nextRecord() {
+			m_type = next();
+		}
+
+		bool
+		readPointer( void *& address ) {
+			if ( m_type != BinaryFormat::Varint ) {
+				return false;
+			}
+			size_t index = size_t( readVarint() );
+			if ( index >= records.size() ) {
+				throw mismatch( "record index" );
+			}
+			address = records[ index ].address;
+			return true;
+		}
+
+		std::vector< Record >	records;
+	};
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttigraphsnapshotH
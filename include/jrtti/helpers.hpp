@@ -5,6 +5,11 @@
 #include <sstream>
 #include <boost/any.hpp>
 #include <boost/type_traits/is_fundamental.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_assign.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
 
 namespace jrtti {
 	/**
@@ -36,6 +41,33 @@ namespace jrtti {
 		return ss >> result ? result : 0;
 	}
 
+	/**
+	 * \brief Byte offset of a data member
+	 *
+	 * Computes the offset of a data member from the beginning of its class,
+	 * as offsetof does, but from a pointer to member.
+	 * \param member pointer to the data member
+	 * \return the offset in bytes of member inside ClassT
+	 */
+	template < typename ClassT, typename PropT >
+	size_t
+	memberOffset( PropT ClassT::* member ) {
+		typename boost::aligned_storage< sizeof( ClassT ), boost::alignment_of< ClassT >::value >::type storage;
+		ClassT * base = reinterpret_cast< ClassT * >( &storage );
+		return reinterpret_cast< char * >( &( base->*member ) ) - reinterpret_cast< char * >( base );
+	}
+
+	/**
+	 * \brief Check if a type can be copied with memcpy
+	 * \tparam T the type to check
+	 */
+	template < typename T >
+	struct is_trivially_copyable {
+		static const bool value =	boost::has_trivial_copy< T >::value &&
+									boost::has_trivial_assign< T >::value &&
+									boost::has_trivial_destructor< T >::value;
+	};
+
 	/**
 	 * \brief Type cast from boost::any
 	 *
@@ -21,6 +21,17 @@
 	#define JRTTI_API  
 #endif
 
+#include <boost/config.hpp>
+
+/**
+ * Defined when objects can be serialized from several threads at once.
+ * Object reference maps are then kept per thread.
+ * \sa NDJSONWriter
+ */
+#if !defined( BOOST_NO_CXX11_THREAD_LOCAL ) && !defined( BOOST_NO_CXX11_HDR_THREAD )
+	#define JRTTI_THREADS
+#endif
+
 /**
  * Use in a *.cpp file to avoid multiple singleton instantation across modules.
  * Define macro JRTTI_SINGLETON_DEFINED before including jrtti.hpp
@@ -40,14 +51,12 @@
 #include <typeinfo>
 #include "exception.hpp"
 #include "annotations.hpp"
+#include "refmaps.hpp"
 
 /// \example sample.h
 /// \example sample.cpp
 
 namespace jrtti {
-	typedef std::map< void *, std::string > AddressRefMap;
-	typedef std::map< std::string, void * > NameRefMap;
-
 	class Error;
 	class Metatype;
 	class Reflector;
@@ -168,8 +177,48 @@ namespace jrtti {
 	_nameRefMap() {
 		return Reflector::instance()._nameRefMap();
 	}
+
+	/**
+	 * \brief Sets aside the address reference map of the thread while in scope
+	 *
+	 * Writes made inside another one, as those of ChangeTracker and Patch, use
+	 * an empty map, or one layered over their own references, and the map of
+	 * the enclosing write is restored when the scope ends.
+	 */
+	class AddressRefScope {
+	public:
+		AddressRefScope() {
+			_addressRefMap().swap( m_saved );
+		}
+
+		/**
+		 * \brief Constructor layering the map of the scope over base
+		 * \param base the references to find, not modified by the scope
+		 */
+		AddressRefScope( const AddressRefMap& base ) {
+			_addressRefMap().swap( m_saved );
+			_addressRefMap().layer( base );
+		}
+
+		~AddressRefScope() {
+			_addressRefMap().swap( m_saved );
+		}
+
+	private:
+		AddressRefScope( const AddressRefScope& );
+		AddressRefScope& operator = ( const AddressRefScope& );
+
+		AddressRefMap	m_saved;	///< map of the enclosing write
+	};
 } //namespace jrtti
 
+#include "dispatcher.hpp"
+#include "changetracker.hpp"
+#include "patch.hpp"
+#include "graphsnapshot.hpp"
+#include "arrayreader.hpp"
+#include "ndjson.hpp"
+
 #if defined (JRTTI_EXPORT) || defined(JRTTI_IMPORT)
 	#ifdef _MSC_VER
 		#pragma warning(pop)
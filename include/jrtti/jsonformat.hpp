@@ -0,0 +1,648 @@
+#ifndef jrttijsonformatH
+#define jrttijsonformatH
+
+#include <cctype>
+#include <cstdlib>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include "exception.hpp"
+#include "helpers.hpp"
+#include "format.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Writer producing the JSON text returned by Metatype::toStr
+ *
+ * Members and elements are written one per line, indented with tabs, or
+ * all in one line in compact mode. Null pointers are written as NULL, object ids as a "$id" member and
+ * references as an object with a single "$ref" member.
+ *
+ * The text is built in memory, or sent to an output stream in chunks as
+ * members and elements are written, so memory does not grow with the size
+ * of the whole text.
+ */
+class JSONWriter : public Writer {
+public:
+	static const size_t defaultBufferSize = 64 * 1024;
+
+	/**
+	 * \brief Constructor
+	 * \param compact if true, values are written without line breaks nor
+	 * indentation
+	 */
+	JSONWriter( bool compact = false )
+		: m_out( NULL ),
+		  m_bufferSize( 0 ),
+		  m_compact( compact ),
+		  m_first( true )
+	{}
+
+	/**
+	 * \brief Constructor for writing to a stream
+	 *
+	 * Text is sent to out when a member or element starts and more than
+	 * bufferSize characters are pending. Call flush when done.
+	 * \param out the stream receiving the text
+	 * \param bufferSize characters kept before sending them to out
+	 */
+	JSONWriter( std::ostream& out, size_t bufferSize = defaultBufferSize )
+		: m_out( &out ),
+		  m_bufferSize( bufferSize ),
+		  m_compact( false ),
+		  m_first( true )
+	{}
+
+	/**
+	 * \brief Sends the pending text to the output stream
+	 *
+	 * Does nothing when writing in memory.
+	 */
+	void
+	flush() {
+		if ( m_out && !m_str.empty() ) {
+			m_out->write( m_str.data(), std::streamsize( m_str.size() ) );
+			m_str.clear();
+		}
+	}
+
+	/**
+	 * \brief Ends a line after a top level value
+	 *
+	 * Used to write a value per line, as in NDJSON.
+	 */
+	void
+	endLine() {
+		m_str += '\n';
+		m_first = true;
+	}
+
+	/**
+	 * \brief The text written so far
+	 *
+	 * When writing to a stream, only the text not sent yet.
+	 * \return the JSON text
+	 */
+	const std::string&
+	str() const {
+		return m_str;
+	}
+
+	void
+	beginObject() {
+		open( '{', false );
+	}
+
+	void
+	writeId( const std::string& id ) {
+		key( "$id" );
+		writeString( id );
+	}
+
+	void
+	key( const std::string& name ) {
+		newItem();
+		appendQuoted( m_str, name );
+		m_str += m_compact ? ":" : ": ";
+	}
+
+	void
+	encodedField( const std::string& name, boost::uint32_t id, const std::string& jsonName ) {
+		newItem();
+		m_str += jsonName;
+		m_str += m_compact ? ":" : ": ";
+	}
+
+	void
+	derivedField( const std::string& type, const std::string& name, boost::uint32_t id, const std::string& jsonName ) {
+		JSONWriter::encodedField( name, id, jsonName );
+	}
+
+	void
+	endObject() {
+		close( '}' );
+	}
+
+	void
+	beginArray( size_t count ) {
+		open( '[', true );
+	}
+
+	void
+	endArray() {
+		close( ']' );
+	}
+
+	void
+	writeRef( const std::string& id ) {
+		beginObject();
+		key( "$ref" );
+		writeString( id );
+		endObject();
+	}
+
+	void
+	writeNull() {
+		value();
+		m_str += "NULL";
+	}
+
+	void
+	writeBool( bool v ) {
+		value();
+		m_str += v ? "true" : "false";
+	}
+
+	void
+	writeChar( char v ) {
+		value();
+		m_str += v;
+	}
+
+	void
+	writeInt( boost::int64_t v ) {
+		value();
+		m_str += numToStr( v );
+	}
+
+	void
+	writeFloat( float v ) {
+		value();
+		m_str += numToStr( v );
+	}
+
+	void
+	writeDouble( double v ) {
+		value();
+		m_str += numToStr( v );
+	}
+
+	void
+	writeLongDouble( long double v ) {
+		value();
+		m_str += numToStr( v );
+	}
+
+	void
+	writeString( const std::string& v ) {
+		value();
+		appendQuoted( m_str, v );
+	}
+
+	void
+	writeStringified( const std::string& json ) {
+		value();
+		size_t start = 0;
+		size_t pos;
+		while ( ( pos = json.find( '\n', start ) ) != std::string::npos ) {
+			m_str.append( json, start, pos - start );
+			if ( m_compact ) {
+				m_str += ' ';
+			}
+			else {
+				m_str += '\n';
+				m_str.append( m_arrays.size(), '\t' );
+			}
+			start = pos + 1;
+		}
+		m_str.append( json, start, std::string::npos );
+	}
+
+	/**
+	 * \brief Quotes and escapes a string as JSON
+	 * \param s the string
+	 * \return the JSON string literal
+	 */
+	static
+	std::string
+	quoted( const std::string& s ) {
+		std::string result;
+		appendQuoted( result, s );
+		return result;
+	}
+
+private:
+	// a value inside an array starts a new element
+	void
+	value() {
+		if ( !m_arrays.empty() && m_arrays.back() ) {
+			newItem();
+		}
+	}
+
+	void
+	newItem() {
+		if ( m_out && m_str.size() >= m_bufferSize ) {
+			flush();
+		}
+		if ( m_compact ) {
+			if ( !m_first ) {
+				m_str += ',';
+			}
+		}
+		else {
+			m_str += m_first ? "\n" : ",\n";
+			m_str.append( m_arrays.size(), '\t' );
+		}
+		m_first = false;
+	}
+
+	void
+	open( char symbol, bool isArray ) {
+		value();
+		m_str += symbol;
+		m_arrays.push_back( isArray );
+		m_first = true;
+	}
+
+	void
+	close( char symbol ) {
+		m_arrays.pop_back();
+		if ( !m_first && !m_compact ) {
+			m_str += '\n';
+			m_str.append( m_arrays.size(), '\t' );
+		}
+		m_str += symbol;
+		m_first = false;
+	}
+
+	static
+	void
+	appendQuoted( std::string& out, const std::string& s ) {
+		static const char hex[] = "0123456789abcdef";
+		out += '"';
+		for ( std::string::const_iterator it = s.begin(); it != s.end(); ++it ) {
+			switch ( *it ) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\b': out += "\\b"; break;
+				case '\f': out += "\\f"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default: {
+					unsigned char c = static_cast< unsigned char >( *it );
+					if ( c < 0x20 ) {
+						out += "\\u00";
+						out += hex[ c >> 4 ];
+						out += hex[ c & 0xf ];
+					}
+					else {
+						out += *it;
+					}
+					break;
+				}
+			}
+		}
+		out += '"';
+	}
+
+	std::ostream *		m_out;			///< NULL when writing in memory
+	size_t				m_bufferSize;
+	bool				m_compact;
+	std::string			m_str;
+	std::vector< bool >	m_arrays;	///< open containers. true for arrays
+	bool				m_first;	///< no member or element written yet in the innermost container
+};
+
+/**
+ * \brief Reader of the JSON text accepted by Metatype::fromStr
+ *
+ * Besides standard JSON, it accepts NULL for null pointers and unquoted
+ * values, as written by previous versions.
+ *
+ * The text is given whole, or read from an input stream in chunks as it is
+ * parsed.
+ */
+class JSONReader : public Reader {
+public:
+	static const size_t chunkSize = 64 * 1024;
+
+	/**
+	 * \brief Constructor
+	 * \param str the JSON text to read
+	 */
+	JSONReader( const std::string& str )
+		: m_in( NULL ),
+		  m_str( str ),
+		  m_pos( 0 ),
+		  m_arrayStart( 0 )
+	{}
+
+	/**
+	 * \brief Constructor for reading from a stream
+	 *
+	 * Text read is kept until discard is called.
+	 * \param in the stream holding the JSON text
+	 */
+	JSONReader( std::istream& in )
+		: m_in( &in ),
+		  m_pos( 0 ),
+		  m_arrayStart( 0 )
+	{}
+
+	/**
+	 * \brief Releases the text already parsed
+	 *
+	 * Called between values, keeps memory bounded when reading from a
+	 * stream. Text is released once more than a chunk was parsed, so the
+	 * cost is amortized over small values.
+	 */
+	void
+	discard() {
+		if ( m_in && m_pos > chunkSize && m_pos <= m_str.length() ) {
+			m_str.erase( 0, m_pos );
+			m_pos = 0;
+		}
+	}
+
+	/**
+	 * \brief Next character of the text, after spaces
+	 * \return the character, or 0 at the end of the text
+	 */
+	char
+	peek() {
+		skipSpaces();
+		return available() ? m_str[ m_pos ] : 0;
+	}
+
+	bool
+	readNull() {
+		skipSpaces();
+		if ( available( 4 ) && ( m_str.compare( m_pos, 4, "NULL" ) == 0 || m_str.compare( m_pos, 4, "null" ) == 0 ) ) {
+			m_pos += 4;
+			return true;
+		}
+		return false;
+	}
+
+	void
+	beginObject() {
+		expect( '{' );
+	}
+
+	bool
+	nextKey( std::string& key ) {
+		if ( !nextItem( '}' ) ) {
+			return false;
+		}
+		key = scalar();
+		expect( ':' );
+		return true;
+	}
+
+	void
+	beginArray() {
+		expect( '[' );
+		m_arrayStart = m_pos;
+	}
+
+	/**
+	 * \brief Number of elements of the array just begun
+	 *
+	 * Elements are counted on each call, by skipping them. They are counted
+	 * only when the text is given whole, a stream would have to keep the
+	 * whole array.
+	 * \return the element count, or 0 when reading from a stream
+	 */
+	size_t
+	arraySize() const {
+		if ( m_in ) {
+			return 0;
+		}
+		JSONReader * self = const_cast< JSONReader * >( this );
+		size_t pos = m_pos;
+		size_t count = 0;
+		self->m_pos = m_arrayStart;
+		while ( self->nextItem( ']' ) ) {
+			self->skip();
+			++count;
+		}
+		self->m_pos = pos;
+		return count;
+	}
+
+	bool
+	nextElement() {
+		return nextItem( ']' );
+	}
+
+	bool
+	readBool() {
+		std::string str = scalar();
+		return !str.empty() && str[ 0 ] == 't';
+	}
+
+	char
+	readChar() {
+		std::string str = scalar();
+		return str.empty() ? 0 : str[ 0 ];
+	}
+
+	boost::int64_t
+	readInt() {
+		return strToNum< boost::int64_t >( scalar() );
+	}
+
+	double
+	readDouble() {
+		return strToNum< double >( scalar() );
+	}
+
+	long double
+	readLongDouble() {
+		return strToNum< long double >( scalar() );
+	}
+
+	std::string
+	readString() {
+		return scalar();
+	}
+
+	std::string
+	readStringified() {
+		skipSpaces();
+		if ( at( '"' ) ) {
+			size_t start = ++m_pos;
+			skipString();
+			return m_str.substr( start, m_pos - start - 1 );
+		}
+		size_t start = m_pos;
+		skip();
+		return m_str.substr( start, m_pos - start );
+	}
+
+	void
+	skip() {
+		skipSpaces();
+		if ( at( '"' ) ) {
+			++m_pos;
+			skipString();
+		}
+		else if ( at( '{' ) || at( '[' ) ) {
+			int depth = 0;
+			while ( available() ) {
+				char c = m_str[ m_pos++ ];
+				if ( c == '"' ) {
+					skipString();
+				}
+				else if ( c == '{' || c == '[' ) {
+					++depth;
+				}
+				else if ( ( c == '}' || c == ']' ) && --depth == 0 ) {
+					break;
+				}
+			}
+		}
+		else {
+			token();
+		}
+	}
+
+	// previous versions wrote members in name order
+	bool
+	peekMember( const std::string& key, std::string& value ) {
+		size_t start = m_pos;
+		skip();
+		std::string name;
+		bool found = false;
+		while ( !found && nextKey( name ) ) {
+			if ( name == key ) {
+				value = scalar();
+				found = true;
+			}
+			else {
+				skip();
+			}
+		}
+		m_pos = start;
+		return found;
+	}
+
+private:
+	// true if n characters are left, reading them from the stream if needed
+	bool
+	available( size_t n = 1 ) {
+		return m_pos + n <= m_str.length() || fill( n );
+	}
+
+	bool
+	fill( size_t n ) {
+		while ( m_in && m_pos + n > m_str.length() ) {
+			size_t size = m_str.length();
+			m_str.resize( size + chunkSize );
+			m_in->read( &m_str[ size ], std::streamsize( chunkSize ) );
+			m_str.resize( size + size_t( m_in->gcount() ) );
+			if ( !m_in->gcount() ) {
+				return false;
+			}
+		}
+		return m_pos + n <= m_str.length();
+	}
+
+	bool
+	at( char c ) {
+		return available() && m_str[ m_pos ] == c;
+	}
+
+	void
+	skipSpaces() {
+		while ( available() && isspace( static_cast< unsigned char >( m_str[ m_pos ] ) ) ) {
+			++m_pos;
+		}
+	}
+
+	void
+	expect( char c ) {
+		skipSpaces();
+		if ( !at( c ) ) {
+			throw Error( std::string( "JSON: '" ) + c + "' expected at position " + numToStr( m_pos ) );
+		}
+		++m_pos;
+	}
+
+	// consumes the separator of the next item. false if close was found instead
+	bool
+	nextItem( char close ) {
+		skipSpaces();
+		if ( at( ',' ) ) {
+			++m_pos;
+			skipSpaces();
+		}
+		if ( !available() ) {
+			throw Error( std::string( "JSON: '" ) + close + "' expected at end of text" );
+		}
+		if ( at( close ) ) {
+			++m_pos;
+			return false;
+		}
+		return true;
+	}
+
+	// a string without its quotes and escape sequences, or an unquoted value
+	std::string
+	scalar() {
+		skipSpaces();
+		if ( !at( '"' ) ) {
+			return token();
+		}
+		std::string result;
+		++m_pos;
+		while ( available() && m_str[ m_pos ] != '"' ) {
+			char c = m_str[ m_pos++ ];
+			if ( c != '\\' || !available() ) {
+				result += c;
+				continue;
+			}
+			c = m_str[ m_pos++ ];
+			switch ( c ) {
+				case 'b': result += '\b'; break;
+				case 'f': result += '\f'; break;
+				case 'n': result += '\n'; break;
+				case 'r': result += '\r'; break;
+				case 't': result += '\t'; break;
+				case 'u': {
+					available( 4 );
+					result += char( strtol( m_str.substr( m_pos, 4 ).c_str(), NULL, 16 ) );
+					m_pos += 4;
+					break;
+				}
+				default: result += c; break;
+			}
+		}
+		++m_pos;
+		return result;
+	}
+
+	std::string
+	token() {
+		size_t start = m_pos;
+		while ( available() && !isspace( static_cast< unsigned char >( m_str[ m_pos ] ) )
+				&& m_str[ m_pos ] != ',' && m_str[ m_pos ] != '}' && m_str[ m_pos ] != ']' && m_str[ m_pos ] != ':' ) {
+			++m_pos;
+		}
+		return m_str.substr( start, m_pos - start );
+	}
+
+	// moves past the closing quote of the string starting at m_pos
+	void
+	skipString() {
+		while ( available() && m_str[ m_pos ] != '"' ) {
+			if ( m_str[ m_pos ] == '\\' ) {
+				++m_pos;
+			}
+			++m_pos;
+		}
+		++m_pos;
+	}
+
+	std::istream *	m_in;	///< NULL when the text is given whole
+	std::string		m_str;
+	size_t			m_pos;
+	size_t			m_arrayStart;	///< position after the '[' of the last array begun
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttijsonformatH
@@ -33,6 +33,11 @@ public:
 			}
 			else {
 				moveToEndChar();
+				// a string element inside an array ends at its closing quote
+				if ( keyCount && m_jsonStr[ pos ] == ',' ) {
+					++pos;
+					skipSpaces();
+				}
             }
 		}
 	}
@@ -2,6 +2,8 @@
 #define jrttimetatypeH
 
 #include <map>
+#include <vector>
+#include <cstring>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/type_traits/remove_pointer.hpp>
@@ -10,6 +12,8 @@
 #include "property.hpp"
 #include "method.hpp"
 #include "jsonparser.hpp"
+#include "fingerprint.hpp"
+#include "jsonformat.hpp"
 
 namespace jrtti {
 
@@ -53,6 +57,15 @@ public:
 	boost::any
 	create() = 0;
 
+	/**
+	 * Destroys an object created by create() or clone()
+	 * \param instance a pointer to the object in a boost::any container
+	 */
+	virtual
+	void
+	destroy( const boost::any& instance ) {
+	}
+
 	/**
 	 * Return the demangled type name of this Metatype
 	 * \return the type name
@@ -123,6 +136,145 @@ public:
 		return false;
 	}
 
+	/**
+	 * \brief Check if this Metatype is the abstraction of a plain old data type
+	 *
+	 * A POD type is trivially copyable and completely described by its properties.
+	 * That is, all its properties are data members of POD types and there are no
+	 * padding bytes between them, as in struct Point { double x, y; }.
+	 * Fundamental types are POD.
+	 * POD objects are copied with memcpy. They are compared with memcmp unless
+	 * they hold floating point members, as -0.0 equals 0.0 and NaN equals nothing.
+	 * \return true if POD
+	 */
+	virtual
+	bool
+	isPOD() const {
+		return false;
+	}
+
+	/**
+	 * \brief Size of the associated type
+	 * \return the size in bytes of the associated type or 0 if unknown
+	 */
+	virtual
+	size_t
+	size() const {
+		return 0;
+	}
+
+	/**
+	 * \brief Creates a copy of an object
+	 *
+	 * Creates a new instance of the associated class as a copy of instance.
+	 * The copy is done by the native copy constructor, that is a memcpy for POD types.
+	 * \param instance the object to copy
+	 * \return a pointer to the created object in a boost::any container
+	 */
+	virtual
+	boost::any
+	clone( const boost::any& instance ) {
+		return boost::any();
+	}
+
+	/**
+	 * \brief Copies the contents of an object into other
+	 *
+	 * The copy is done by the native assignment operator or by memcpy for POD types.
+	 * \param dest the object to copy to
+	 * \param source the object to copy from
+	 */
+	virtual
+	void
+	copy( const boost::any& dest, const boost::any& source ) {
+	}
+
+	/**
+	 * \brief Compares two objects for equality
+	 *
+	 * POD objects without floating point members are compared with memcmp.
+	 * Otherwise, the readable properties of both objects are compared one by one. Pointer properties are equal if
+	 * they point to the same object.
+	 * \param a first object to compare
+	 * \param b second object to compare
+	 * \return true if both objects are equal
+	 */
+	virtual
+	bool
+	equals( const boost::any& a, const boost::any& b ) {
+		void * pa = get_instance_ptr( a );
+		void * pb = get_instance_ptr( b );
+		if ( pa == pb ) {
+			return true;
+		}
+		if ( !pa || !pb ) {
+			return false;
+		}
+		if ( _comparesBytes() ) {
+			return memcmp( pa, pb, size() ) == 0;
+		}
+
+		for( PropertyMap::iterator it = _properties().begin(); it != _properties().end(); ++it) {
+			Property * prop = it->second;
+			if ( prop && !prop->isPending() && prop->isReadable() ) {
+				StringifyDelegateBase * stringifyDelegate = prop->stringifyDelegate();
+				if ( stringifyDelegate ) {
+					if ( stringifyDelegate->toStr( pa ) != stringifyDelegate->toStr( pb ) ) {
+						return false;
+					}
+					continue;
+				}
+				void * ma = memberInstance( *prop, pa );
+				if ( ma ) {
+					if ( !prop->metatype().equals( ma, memberInstance( *prop, pb ) ) ) {
+						return false;
+					}
+				}
+				else {
+					if ( !prop->metatype().equals( prop->get( pa ), prop->get( pb ) ) ) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * \brief Creates a deep copy of an object graph
+	 *
+	 * The object is copied natively and then every writable pointer property is
+	 * set to a deep copy of its pointed object. Collection elements are copied
+	 * deeply as well. Objects shared inside the graph are copied once, so shared
+	 * references and cycles are preserved in the copy. POD objects are copied
+	 * with memcpy without walking their properties.
+	 * \param instance the object to copy
+	 * \return a pointer to the created object in a boost::any container
+	 * \throw Error if an object of an abstract type has to be copied
+	 */
+	boost::any
+	deepClone( const boost::any& instance ) {
+		CloneMap clones;
+		return _deepClone( instance, clones );
+	}
+
+	/**
+	 * \brief Compares two object graphs for equality
+	 *
+	 * As equals, but pointed objects are compared by contents. Both graphs must
+	 * share the same structure: an object reached more than once in a graph has
+	 * to correspond to a single object in the other graph. POD objects are
+	 * compared as in equals.
+	 * \param a first object to compare
+	 * \param b second object to compare
+	 * \return true if both object graphs are equal
+	 */
+	bool
+	deepEquals( const boost::any& a, const boost::any& b ) {
+		ObjectPairing pairing;
+		return _deepEquals( a, b, pairing );
+	}
+
 	/**
 	 * \brief Check for inheritance
 	 *
@@ -205,13 +357,68 @@ public:
 	 */
 	Method&
 	method(std::string name) {
-		MethodMap::iterator it = _methods().find(name);
-		if ( it == _methods().end() ) {
+		Method * m = findMethod( name );
+		if ( !m ) {
 			throw Error( "Method '" + name + "' not declared in '" + Metatype::name() + "' metaclass" );
 		}
-		return *it->second;
+		return *m;
 	}
 
+	/**
+	 * \brief Looks for a method
+	 *
+	 * Looks for a method of this class by name. The method table is not modified.
+	 * \param name the name of the method to look for
+	 * \return the found method abstraction or NULL if not found
+	 */
+	Method *
+	findMethod( const std::string& name ) {
+		MethodMap::iterator it = _methods().find( name );
+		return it == _methods().end() ? NULL : it->second;
+	}
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+	/**
+	 * \brief Resolves a method handle
+	 *
+	 * Looks for a method by name and checks its signature. The returned handle
+	 * invokes the method without further lookups.
+	 * \tparam Signature the expected method signature as ReturnT ( Params... )
+	 * \param name the name of the method to look for
+	 * \return the resolved method handle
+	 * \throw Error if method not found
+	 * \throw BadCast if method signature does not match
+	 */
+	template < typename Signature >
+	MethodHandle< Signature >
+	methodHandle( const std::string& name ) {
+		return MethodHandle< Signature >( method( name ) );
+	}
+#endif
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+	/**
+	 * \brief Invoke a method
+	 *
+	 * Invokes a method from class ClassT by name.
+	 * \tparam ReturnT the return type of the method.
+	 * \tparam ClassT the class type of this Metatype.
+	 * \tparam Params the parameter types of the method.
+	 * \param methodName the name of the method to invoke
+	 * \param instance the object instance where the method will be invoked
+	 * \param params method parameters
+	 * \return the call result
+	 * \throw Error if method not found
+	 */
+	template < class ReturnT, class ClassT, class... Params >
+	ReturnT
+	call ( std::string methodName, ClassT * instance, Params... params ) {
+		typedef TypedMethod< typename boost::remove_pointer< ClassT >::type, ReturnT, Params... > MethodType;
+
+		MethodType * ptr = static_cast< MethodType * >( &signedMethod( methodName, typeid( ReturnT ( Params... ) ) ) );
+		return ptr->call( instance, params... );
+	}
+#else
 	/**
 	 * \brief Invoke a method without parameters
 	 *
@@ -228,10 +435,7 @@ public:
 	call ( std::string methodName, ClassT * instance ) {
 		typedef TypedMethod< boost::remove_pointer< ClassT >::type, ReturnT > MethodType;
 
-		MethodType * ptr = static_cast< MethodType * >( _methods()[methodName] );
-		if (!ptr) {
-			throw Error("Method '" + methodName + "' not found in '" + name() + "' metaclass");
-		}
+		MethodType * ptr = static_cast< MethodType * >( &signedMethod( methodName, typeid( ReturnT () ) ) );
 		return ptr->call(instance);
 	}
 
@@ -253,10 +457,7 @@ public:
 	call ( std::string methodName, ClassT * instance, Param1 p1 ) {
 		typedef TypedMethod< ClassT, ReturnT, Param1 > MethodType;
 
-		MethodType * ptr = static_cast< MethodType * >( m_methods[methodName] );
-		if (!ptr) {
-			throw Error("Method '" + methodName + "' not found in '" + name() + "' metaclass");
-		}
+		MethodType * ptr = static_cast< MethodType * >( &signedMethod( methodName, typeid( ReturnT ( Param1 ) ) ) );
 		return ptr->call(instance,p1);
 	}
 
@@ -280,12 +481,27 @@ public:
 	call ( std::string methodName, ClassT * instance, Param1 p1, Param2 p2 ) {
 		typedef TypedMethod< ClassT, ReturnT, Param1, Param2 > MethodType;
 
-		MethodType * ptr = static_cast< MethodType * >( m_methods[methodName] );
-		if (!ptr) {
-			throw Error("Method '" + methodName + "' not found in '" + name() + "' metaclass");
-		}
+		MethodType * ptr = static_cast< MethodType * >( &signedMethod( methodName, typeid( ReturnT ( Param1, Param2 ) ) ) );
 		return ptr->call(instance,p1,p2);
 	}
+#endif
+
+	/**
+	 * \brief Invoke a method with a type erased argument list
+	 *
+	 * Invokes a method by name without knowing its signature at compile time.
+	 * Arguments are converted to the method parameter types.
+	 * \param methodName the name of the method to invoke
+	 * \param instance the object instance where the method will be invoked
+	 * \param args array of arguments
+	 * \param count number of arguments
+	 * \return the call result. Empty if method returns void
+	 * \throw Error if method not found or count does not match the method arity
+	 */
+	boost::any
+	invoke( const std::string& methodName, const boost::any& instance, const boost::any * args = NULL, size_t count = 0 ) {
+		return method( methodName ).invoke( get_instance_ptr( instance ), args, count );
+	}
 
 	/**
 	 * \brief Evaluates a full categorized property
@@ -308,6 +524,10 @@ public:
 		if (pos == std::string::npos)
 			return prop.get(inst);
 		else {
+			void * member = memberInstance( prop, inst );
+			if ( member ) {
+				return prop.metatype().eval( member, path.substr( pos + 1 ) );
+			}
 			return prop.metatype().eval( prop.get( inst ), path.substr( pos + 1 ));
 		}
 	}
@@ -338,20 +558,29 @@ public:
 	 */
 	boost::any
 	apply( const boost::any& instance, std::string path, const boost::any& value, bool doCopyFromInstance = false ) {
-		size_t pos = path.find_first_of(".");
-		std::string name = path.substr( 0, pos );
-		Property& prop = property(name);
-
-		void * inst = get_instance_ptr(instance);
-		if (pos == std::string::npos) {
-			prop.set( inst, value );
+		void * inst = _apply( instance, path, value, NULL );
+		if ( doCopyFromInstance ) {
+			return copyFromInstance( inst );
 		}
 		else {
-			const boost::any &mod = prop.metatype().apply( prop.get(inst), path.substr( pos + 1 ), value, true );
-			if ( !prop.metatype().isPointer() ) {
-				prop.set( inst, mod );
-			}
+			return boost::any();
 		}
+	}
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/**
+	 * \brief Set the value of a full categorized property moving it from a temporary
+	 *
+	 * Same as apply( const boost::any&, std::string, const boost::any&, bool ) but
+	 * the value is moved into the target property when types match.
+	 * \param instance the object instance from where to set the property value
+	 * \param path full categorized property name dotted separated. ex: "pont.x"
+	 * \param value property value to set
+	 * \return used internally
+	 */
+	boost::any
+	apply( const boost::any& instance, std::string path, boost::any&& value, bool doCopyFromInstance = false ) {
+		void * inst = _apply( instance, path, value, &value );
 		if ( doCopyFromInstance ) {
 			return copyFromInstance( inst );
 		}
@@ -359,6 +588,7 @@ public:
 			return boost::any();
 		}
 	}
+#endif
 
 	/**
 	 * \brief Retrieves a string representation of object contens
@@ -375,6 +605,43 @@ public:
 		return _toStr( instance, formatForStreaming );
 	}
 
+	/**
+	 * \brief Writes the string representation of an object to a stream
+	 *
+	 * Writes the text returned by toStr, sending it to out as it is
+	 * produced. Collection elements are written one at a time, so memory
+	 * does not grow with the number of elements.
+	 * \param instance the object instance to write
+	 * \param out the output stream
+	 * \param formatForStreaming as in toStr
+	 * \throw Error if out fails
+	 */
+	void
+	toStream( const boost::any & instance, std::ostream& out, bool formatForStreaming = false ) {
+		_addressRefMap().clear();
+		JSONWriter writer( out );
+		_write( instance, writer, formatForStreaming );
+		writer.flush();
+		if ( !out ) {
+			throw Error( "Error writing '" + name() + "' to stream" );
+		}
+	}
+
+	/**
+	 * \brief Writes object contents to a serialization format
+	 *
+	 * Walks the object as toStr does, reporting its values to writer.
+	 * \param instance the object instance to write
+	 * \param writer the format writer
+	 * \param formatForStreaming if true, object ids and references are written
+	 * and the properties not streamable are skipped
+	 */
+	void
+	write( const boost::any& instance, Writer& writer, bool formatForStreaming = false ) {
+		_addressRefMap().clear();
+		_write( instance, writer, formatForStreaming );
+	}
+
 	/**
 	 * \brief Fills an object from a string representation
 	 *
@@ -389,6 +656,107 @@ public:
 		_fromStr( instance, str, false );
 	}
 
+	/**
+	 * \brief Fills an object from a serialization format
+	 *
+	 * Reads the object as fromStr does, pulling its values from reader.
+	 * \param instance the object instance to fill
+	 * \param reader the format reader positioned at the object
+	 */
+	void
+	read( const boost::any& instance, Reader& reader ) {
+		_nameRefMap().clear();
+		_read( instance, reader, false );
+	}
+
+	/**
+	 * \brief Encodes object contents as MessagePack
+	 *
+	 * Objects are encoded as toStr does for streaming: object ids and
+	 * references are kept, and the properties not streamable are skipped.
+	 * Defined in msgpack.hpp, which is not included by jrtti.hpp.
+	 * \param instance the object instance to encode
+	 * \return the MessagePack encoded data
+	 */
+	std::string
+	toMsgPack( const boost::any& instance );
+
+	/**
+	 * \brief Fills an object from its MessagePack encoding
+	 *
+	 * Defined in msgpack.hpp, which is not included by jrtti.hpp.
+	 * \param instance the object instance to fill
+	 * \param data MessagePack data as returned by toMsgPack
+	 */
+	void
+	fromMsgPack( const boost::any& instance, const std::string& data );
+
+	/**
+	 * \brief Encodes object contents in the compact binary format
+	 *
+	 * Properties are identified by field id, integers are stored as varints
+	 * and every value is length prefixed, so fields unknown to the reader are
+	 * skipped without decoding them. The data starts with the
+	 * schemaFingerprint of this metatype.
+	 * Objects are encoded as toStr does for streaming: object ids and
+	 * references are kept, and the properties not streamable are skipped.
+	 * Defined in binaryformat.hpp.
+	 * \param instance the object instance to encode
+	 * \return the binary encoded data
+	 * \sa FieldId
+	 */
+	std::string
+	toBinary( const boost::any& instance );
+
+	/**
+	 * \brief Fills an object from its binary encoding
+	 *
+	 * Data written with a different schema is accepted: properties are
+	 * matched by field id and unknown fields are skipped. Ids derived from
+	 * names may collide, so when the schema fingerprint of the data differs
+	 * from schemaFingerprint, their property names are checked too.
+	 * \param instance the object instance to fill
+	 * \param data binary data as returned by toBinary
+	 * \throw Error if data is not in the binary format or is truncated
+	 */
+	void
+	fromBinary( const boost::any& instance, const std::string& data );
+
+	/**
+	 * \brief Computes a 64-bit fingerprint of the serialization schema
+	 *
+	 * Hashes the type name and the field ids, names and types of the
+	 * properties of this metatype and of the metatypes they reference.
+	 * toBinary writes it in the data header, so readers can tell whether data
+	 * was written with their schema (see BinaryReader::schemaFingerprint).
+	 * Type names are compiler specific, so fingerprints should not be
+	 * compared across toolchains.
+	 * \return the schema fingerprint
+	 */
+	Fingerprint::Value
+	schemaFingerprint() {
+		Fingerprint fp;
+		_schemaFingerprint( fp );
+		return fp.value();
+	}
+
+	/**
+	 * \brief Computes a 64-bit fingerprint of object contents
+	 *
+	 * Hashes the values of the streamable properties following the same
+	 * traversal as toStr for streaming, without building the string
+	 * representation. Objects reached more than once are hashed by their
+	 * visit order, so cycles are handled.
+	 * \param instance the object instance to fingerprint
+	 * \return the fingerprint. Equal objects have equal fingerprints
+	 */
+	Fingerprint::Value
+	fingerprint( const boost::any& instance ) {
+		Fingerprint fp;
+		_fingerprint( instance, fp );
+		return fp.value();
+	}
+
 	const PropertyMap &
 	properties() {
 		return _properties();
@@ -426,6 +794,7 @@ public:
 	addProperty( std::string name, Property * prop) {
 		_properties()[name] = prop;
 		m_ownedProperties[ name ] = prop;
+		propertiesChanged();
 	}
 
 	/**
@@ -439,6 +808,7 @@ public:
 			_properties().erase( name );
 			delete elem->second;
 			m_ownedProperties.erase( elem );
+			propertiesChanged();
 		}
 	}
 
@@ -472,6 +842,10 @@ protected:
 	friend class MetaPointerType;
 	template< typename C > friend class Metacollection;
 	template< typename C, typename A > friend class CustomMetaclass;
+	friend class Dispatcher;
+	friend class ChangeTracker;
+	friend class Patch;
+	template< typename T > friend class ArrayReader;
 
 	Metatype( const std::type_info& typeinfo, const Annotations& annotations = Annotations() )
 		:	m_type_info( typeinfo ),
@@ -490,6 +864,84 @@ protected:
 		return m_methods;
 	}
 
+	/**
+	 * Called when properties are added or removed, to discard information
+	 * derived from them
+	 */
+	virtual
+	void
+	propertiesChanged() {
+		m_plan.built = false;
+		++_propertiesGeneration();
+	}
+
+	/**
+	 * Incremented when the properties of any metatype change, so information
+	 * derived from the properties of other metatypes can be recomputed
+	 */
+	static
+	unsigned&
+	_propertiesGeneration() {
+		static unsigned generation = 0;
+		return generation;
+	}
+
+	/**
+	 * \brief Check if objects are equal when their bytes are
+	 *
+	 * True for POD types without floating point members.
+	 */
+	virtual
+	bool
+	_comparesBytes() const {
+		return false;
+	}
+
+	/**
+	 * Serialization data of a property, resolved when the plan is built
+	 */
+	struct PlanEntry {
+		Property *	property;
+		Metatype *	metatype;
+		std::string	name;
+		std::string	jsonName;	///< name quoted and escaped as a JSON string
+		boost::uint32_t	fieldId;	///< 0 if it collides with a previous entry
+		bool		isTypeName;	///< the __typeInfoName property
+	};
+
+	/**
+	 * Properties of a metatype in streaming order, as used by _write and _read.
+	 * __typeInfoName goes first, so readers know the type of an object before
+	 * reading its other properties.
+	 * Built on first use and discarded when properties are added or deleted,
+	 * or when the type of a pending property is declared, never while the
+	 * plan is traversed. Pending properties are left out.
+	 * Annotations and modes are read from the property on each use, so they
+	 * are never stale. Field ids are resolved when the plan is built.
+	 */
+	struct SerializationPlan {
+		SerializationPlan()
+			: built( false ),
+			  complete( false )
+		{}
+
+		bool							built;
+		bool							complete;	///< false if pending properties were left out
+		std::vector< PlanEntry >		entries;
+		std::map< std::string, size_t >	index;
+		std::map< boost::uint32_t, size_t >	ids;
+		std::string						typeName;	///< name of the metatype, passed to formats checking derived field ids
+	};
+
+	virtual
+	SerializationPlan&
+	_plan() {
+		if ( !m_plan.built ) {
+			buildPlan();
+		}
+		return m_plan;
+	}
+
 	void
 	parentMetatype( Metatype * parent ) {
 		m_parentMetatype = parent;
@@ -506,94 +958,438 @@ protected:
 		return m_pointerMetatype;
 	}
 
+	/**
+	 * \brief The metatype describing the objects, the pointed one for pointers
+	 */
 	virtual
+	Metatype&
+	_objectType() {
+		return *this;
+	}
+
 	std::string
 	_toStr( const boost::any & instance, bool formatForStreaming ) {
+		JSONWriter writer;
+		_write( instance, writer, formatForStreaming );
+		return writer.str();
+	}
+
+	virtual
+	void
+	_write( const boost::any & instance, Writer& writer, bool formatForStreaming ) {
 		void * inst = get_instance_ptr(instance);
-		std::string result = "{\n";
-		bool need_nl = false;
+		writer.beginObject();
 
-		AddressRefMap::iterator it = _addressRefMap().find( inst );
-		if ( it == _addressRefMap().end() ) {
-			std::string idStr = numToStr<int>( _addressRefMap().size() );
-			_addressRefMap()[ inst ] = idStr;
+		// objects held by value are temporary copies and can not be referenced
+		size_t id;
+		if ( !_addressRefMap().find( inst, id ) && !( instance.type() == typeInfo() && !isPointer() ) ) {
+			id = _addressRefMap().insert( inst );
 			if ( formatForStreaming ) {
-				need_nl = true;
-				result += "\t\"$id\": \"" + idStr + "\"";
+				writer.writeId( _addressRefMap().idStr( id ) );
 			}
 		}
 
-		for( PropertyMap::iterator it = _properties().begin(); it != _properties().end(); ++it) {
-			Property * prop = it->second;
-			if ( prop && prop->isReadable() ) {
-				if ( !( formatForStreaming && prop->annotations().has< NoStreamable >() ) ) {
-					if (need_nl) result += ",\n";
-					need_nl = true;
-
-					std::string addToResult;
-					StringifyDelegateBase * stringifyDelegate = prop->annotations().getFirst< StringifyDelegateBase >();
+		SerializationPlan& plan = _plan();
+		for( std::vector< PlanEntry >::iterator entry = plan.entries.begin(); entry != plan.entries.end(); ++entry ) {
+			Property * prop = entry->property;
+			if ( prop->isReadable() ) {
+				if ( !( formatForStreaming && !prop->isStreamable() ) ) {
+					if ( entry->fieldId > FieldId::maxId ) {
+						writer.derivedField( plan.typeName, entry->name, entry->fieldId, entry->jsonName );
+					}
+					else {
+						writer.encodedField( entry->name, entry->fieldId, entry->jsonName );
+					}
+					StringifyDelegateBase * stringifyDelegate = prop->stringifyDelegate();
 					if ( stringifyDelegate ) {
-						addToResult = stringifyDelegate->toStr( inst );
+						writer.writeStringified( stringifyDelegate->toStr( inst ) );
+					}
+					else if ( entry->isTypeName ) {
+						writer.writeTypeName( prop->get< std::string >( inst ) );
 					}
 					else {
-						addToResult = prop->metatype()._toStr( prop->get(inst), formatForStreaming );
+						entry->metatype->_write( prop->get(inst), writer, formatForStreaming );
 					}
-					result += ident( "\"" + prop->name() + "\"" + ": " + addToResult );
 				}
 			}
 		}
-		return result += "\n}";
+		writer.endObject();
 	}
 
 	virtual
+	void
+	_fingerprint( const boost::any& instance, Fingerprint& fp ) {
+		void * inst = get_instance_ptr( instance );
+		// objects held by value are temporary copies and can not be referenced
+		if ( !( instance.type() == typeInfo() && !isPointer() ) ) {
+			fp.visit( inst );
+		}
+
+		SerializationPlan& plan = _plan();
+		for( std::vector< PlanEntry >::iterator entry = plan.entries.begin(); entry != plan.entries.end(); ++entry ) {
+			Property * prop = entry->property;
+			if ( prop->isReadable() && prop->isStreamable() ) {
+				StringifyDelegateBase * stringifyDelegate = prop->stringifyDelegate();
+				if ( stringifyDelegate ) {
+					fp.update( stringifyDelegate->toStr( inst ) );
+				}
+				else if ( !( prop->isDataMember() && entry->metatype->_fingerprintAt( prop->address( inst ), fp ) ) ) {
+					entry->metatype->_fingerprint( prop->get( inst ), fp );
+				}
+			}
+		}
+	}
+
+	void
+	_schemaFingerprint( Fingerprint& fp ) {
+		size_t order;
+		if ( fp.visited( this, order ) ) {
+			fp.update( order );
+			return;
+		}
+		fp.visit( this );
+		fp.update( name() );
+		SerializationPlan& plan = _plan();
+		for( std::vector< PlanEntry >::iterator entry = plan.entries.begin(); entry != plan.entries.end(); ++entry ) {
+			fp.update( entry->fieldId );
+			fp.update( entry->name );
+			entry->metatype->_schemaFingerprint( fp );
+		}
+	}
+
+	// objects are identified by address and metatype, as a member may share the address of its owner
+	typedef std::pair< void *, const Metatype * >	ObjectKey;
+	typedef std::map< ObjectKey, boost::any >		CloneMap;
+
+	/**
+	 * Correspondence between the objects of two graphs
+	 */
+	struct ObjectPairing {
+		std::map< ObjectKey, void * >	aToB;
+		std::map< ObjectKey, void * >	bToA;
+	};
+
+	virtual
+	boost::any
+	_deepClone( const boost::any& instance, CloneMap& clones ) {
+		void * inst = get_instance_ptr( instance );
+		if ( !inst ) {
+			return createAsNullPtr();
+		}
+		ObjectKey key( inst, this );
+		CloneMap::iterator it = clones.find( key );
+		if ( it != clones.end() ) {
+			return it->second;
+		}
+		boost::any copy = clone( instance );
+		void * target = get_instance_ptr( copy );
+		if ( !target ) {
+			throw Error( "Can not clone '" + name() + "'" );
+		}
+		clones[ key ] = copy;
+		if ( !isPOD() ) {
+			_deepCopyPointers( inst, target, clones );
+		}
+		return copy;
+	}
+
+	/**
+	 * Replaces the pointers of target, a native copy of source, by deep
+	 * copies of the objects pointed by source.
+	 */
+	virtual
+	void
+	_deepCopyPointers( void * source, void * target, CloneMap& clones ) {
+		SerializationPlan& plan = _plan();
+		for( std::vector< PlanEntry >::iterator entry = plan.entries.begin(); entry != plan.entries.end(); ++entry ) {
+			Property * prop = entry->property;
+			Metatype * propType = entry->metatype;
+			if ( !propType || !prop->isReadable() || prop->stringifyDelegate() || propType->isFundamental()
+				 || propType->isPOD() || propType->typeInfo() == typeid( std::string ) ) {
+				continue;
+			}
+			if ( propType->isPointer() ) {
+				if ( prop->isWritable() ) {
+					boost::any value = prop->get( source );
+					if ( propType->get_instance_ptr( value ) ) {
+						prop->set( target, propType->_deepClone( value, clones ) );
+					}
+				}
+				continue;
+			}
+			void * memberSource = memberInstance( *prop, source );
+			void * memberTarget = memberInstance( *prop, target );
+			if ( memberSource && memberTarget ) {
+				// pointers to the member are redirected to the member of the copy
+				clones[ ObjectKey( memberSource, propType ) ] = propType->copyFromInstanceAsPtr( memberTarget );
+				propType->_deepCopyPointers( memberSource, memberTarget, clones );
+			}
+			else {
+				// nested objects returned by value are fixed and then moved back
+				boost::any nested = prop->get( target );
+				void * nestedTarget = propType->get_instance_ptr( nested );
+				if ( nestedTarget ) {
+					propType->_deepCopyPointers( nestedTarget, nestedTarget, clones );
+					if ( nested.type() == propType->typeInfo() ) {
+						prop->set( target, boost::move( nested ) );
+					}
+				}
+			}
+		}
+	}
+
+	virtual
+	bool
+	_deepEquals( const boost::any& a, const boost::any& b, ObjectPairing& pairing ) {
+		void * pa = get_instance_ptr( a );
+		void * pb = get_instance_ptr( b );
+		if ( pa == pb ) {
+			return true;
+		}
+		if ( !pa || !pb ) {
+			return false;
+		}
+		if ( _comparesBytes() ) {
+			return memcmp( pa, pb, size() ) == 0;
+		}
+		// objects held by value are temporary copies and can not be shared
+		if ( !( a.type() == typeInfo() && !isPointer() ) ) {
+			ObjectKey keyA( pa, this );
+			ObjectKey keyB( pb, this );
+			std::map< ObjectKey, void * >::iterator itA = pairing.aToB.find( keyA );
+			std::map< ObjectKey, void * >::iterator itB = pairing.bToA.find( keyB );
+			if ( itA != pairing.aToB.end() || itB != pairing.bToA.end() ) {
+				// already compared or being compared
+				return itA != pairing.aToB.end() && itB != pairing.bToA.end() && itA->second == pb && itB->second == pa;
+			}
+			pairing.aToB[ keyA ] = pb;
+			pairing.bToA[ keyB ] = pa;
+		}
+
+		SerializationPlan& plan = _plan();
+		for( std::vector< PlanEntry >::iterator entry = plan.entries.begin(); entry != plan.entries.end(); ++entry ) {
+			Property * prop = entry->property;
+			if ( !prop->isReadable() ) {
+				continue;
+			}
+			StringifyDelegateBase * stringifyDelegate = prop->stringifyDelegate();
+			if ( stringifyDelegate ) {
+				if ( stringifyDelegate->toStr( pa ) != stringifyDelegate->toStr( pb ) ) {
+					return false;
+				}
+				continue;
+			}
+			void * ma = memberInstance( *prop, pa );
+			if ( ma ) {
+				if ( !entry->metatype->_deepEquals( ma, memberInstance( *prop, pb ), pairing ) ) {
+					return false;
+				}
+			}
+			else {
+				if ( !entry->metatype->_deepEquals( prop->get( pa ), prop->get( pb ), pairing ) ) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Hashes the object of this type at address, avoiding its copy into a
+	 * boost::any.
+	 * \return false if not supported by this type
+	 */
+	virtual
+	bool
+	_fingerprintAt( const void * address, Fingerprint& fp ) {
+		return false;
+	}
+
 	boost::any
 	_fromStr( const boost::any & instance, const std::string& str, bool doCopyFromInstance = true ) {
+		JSONReader reader( str );
+		return _read( instance, reader, doCopyFromInstance );
+	}
+
+	virtual
+	boost::any
+	_read( const boost::any & instance, Reader& reader, bool doCopyFromInstance = true ) {
+		reader.beginObject();
+		std::string key;
+		if ( !reader.nextKey( key ) ) {
+			return doCopyFromInstance ? copyFromInstance( get_instance_ptr( instance ) ) : boost::any();
+		}
+		return _readMembers( instance, reader, key, doCopyFromInstance );
+	}
+
+	/**
+	 * Reads the members of an object whose first key was already read
+	 */
+	boost::any
+	_readMembers( const boost::any & instance, Reader& reader, std::string& key, bool doCopyFromInstance ) {
 		void * inst = get_instance_ptr(instance);
-		JSONParser parser( str );
+		SerializationPlan& plan = _plan();
+		size_t next = 0;
 
-		for( JSONParser::iterator it = parser.begin(); it != parser.end(); ++it) {
-			if ( it->first == "$ref" ) {
-				return copyFromInstance( _nameRefMap()[ it->second ] );
+		do {
+			if ( key == "$ref" ) {
+				return copyFromInstance( readRef( reader ) );
 			}
-			if ( it->first == "$id" ) {
-				_nameRefMap()[ it->second ] = inst;
+			if ( key == "$id" ) {
+				addRef( reader, inst );
 			}
 			else
 			{
-				Property * prop = _properties()[ it->first ];
-				if ( prop ) {
-					if ( prop->isWritable() || prop->annotations().has< ForceStreamLoadable >() ) {
-						StringifyDelegateBase * stringifyDelegate = prop->annotations().getFirst< StringifyDelegateBase >();
-						if ( stringifyDelegate ) {
-							stringifyDelegate->fromStr( inst, it->second );
-						}
-						else {
-							const boost::any &mod = prop->metatype()._fromStr( prop->get( inst ), it->second );
-							if ( !mod.empty() ) {
-								prop->set( inst, mod );
-							}
-						}
-					}
+				PlanEntry * entry = reader.fieldId() ? planEntry( plan, reader.fieldId(), next ) : planEntry( plan, key, next );
+				if ( entry && reader.fieldId() > FieldId::maxId && !reader.matchesField( plan.typeName, entry->name ) ) {
+					entry = NULL;
+				}
+				if ( entry && ( entry->property->isWritable() || entry->property->isForceStreamLoadable() ) ) {
+					loadProperty( *entry->property, *entry->metatype, inst, reader );
+				}
+				else {
+					reader.skip();
 				}
 			}
-		}
+		} while ( reader.nextKey( key ) );
+
 		if ( doCopyFromInstance )
 			return copyFromInstance( inst );
 		else
 			return boost::any();
 	}
 
-	std::string
-	ident( std::string str ) {
-		std::string result = "\t";
-		for (std::string::iterator it = str.begin(); it !=str.end() ; ++it) {
-			if ( *it == '\n' ) {
-				result += "\n\t";
+	/**
+	 * Reads the value of a $id key and registers inst with it
+	 */
+	static
+	void
+	addRef( Reader& reader, void * inst ) {
+		size_t id;
+		std::string name;
+		if ( reader.readId( id, name ) ) {
+			_nameRefMap().add( id, inst );
+		}
+		else {
+			_nameRefMap().add( name, inst );
+		}
+	}
+
+	/**
+	 * Reads the value of a $ref key and the rest of its object.
+	 * \return the referenced object
+	 */
+	void *
+	readRef( Reader& reader ) {
+		size_t id;
+		std::string name;
+		void * ptr = reader.readId( id, name ) ? _nameRefMap().find( id ) : _nameRefMap().find( name );
+		std::string key;
+		while ( reader.nextKey( key ) ) {
+			reader.skip();
+		}
+		return ptr;
+	}
+
+	/**
+	 * Loads the value of a property of inst from reader.
+	 * propType is the metatype of prop.
+	 */
+	void
+	loadProperty( Property& prop, Metatype& propType, void * inst, Reader& reader ) {
+		StringifyDelegateBase * stringifyDelegate = prop.stringifyDelegate();
+		if ( stringifyDelegate ) {
+			stringifyDelegate->fromStr( inst, reader.readStringified() );
+		}
+		else {
+			// nested objects held by data members are read in place
+			void * member = memberInstance( prop, inst );
+			boost::any mod = member ? propType._read( member, reader, false ) : propType._read( prop.get( inst ), reader );
+			if ( !mod.empty() ) {
+				prop.set( inst, boost::move( mod ) );
 			}
-			else
-				result += *it;
+			else if ( member ) {
+				prop.notifyChanged( inst );
+			}
+		}
+	}
+
+	/**
+	 * Loads the value of a property of inst from its JSON representation.
+	 */
+	void
+	loadProperty( Property& prop, Metatype& propType, void * inst, const std::string& str ) {
+		JSONReader reader( str );
+		loadProperty( prop, propType, inst, reader );
+	}
+
+	/**
+	 * Method by name with the given signature.
+	 */
+	Method&
+	signedMethod( const std::string& methodName, const std::type_info& signature ) {
+		Method * m = findMethod( methodName );
+		if ( !m ) {
+			throw Error("Method '" + methodName + "' not found in '" + name() + "' metaclass");
 		}
-		return result;
+		if ( m->signature() != signature ) {
+			throw BadCast( "method '" + methodName + "' with signature " + demangle( m->signature().name() ) );
+		}
+		return *m;
+	}
+
+	/**
+	 * Address of a nested object held by value as a class data member.
+	 * Nested paths are resolved in place through it, without copying the
+	 * intermediate object.
+	 */
+	void *
+	memberInstance( const Property& prop, void * inst ) {
+		if ( prop.metatype().isPointer() || prop.metatype().isFundamental() ) {
+			return NULL;
+		}
+		return prop.address( inst );
+	}
+
+	/**
+	 * Resolves path and sets value in the target property.
+	 * If movableValue is not NULL, it points to value and can be moved from.
+	 * \return the address of instance
+	 */
+	void *
+	_apply( const boost::any& instance, const std::string& path, const boost::any& value, boost::any * movableValue ) {
+		size_t pos = path.find_first_of(".");
+		Property& prop = property( path.substr( 0, pos ) );
+
+		void * inst = get_instance_ptr(instance);
+		if (pos == std::string::npos) {
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+			if ( movableValue ) {
+				prop.set( inst, std::move( *movableValue ) );
+				return inst;
+			}
+#endif
+			prop.set( inst, value );
+		}
+		else {
+			void * member = memberInstance( prop, inst );
+			if ( member ) {
+				prop.metatype()._apply( member, path.substr( pos + 1 ), value, movableValue );
+				prop.notifyChanged( inst );
+			}
+			else {
+				// nested objects returned by value are modified in place and then moved back
+				boost::any nested = prop.get( inst );
+				prop.metatype()._apply( nested, path.substr( pos + 1 ), value, movableValue );
+				if ( !prop.metatype().isPointer() && nested.type() == prop.metatype().typeInfo() ) {
+					prop.set( inst, boost::move( nested ) );
+				}
+				else {
+					prop.notifyChanged( inst );
+				}
+			}
+		}
+		return inst;
 	}
 
 	virtual
@@ -603,6 +1399,91 @@ protected:
 	}
 
 private:
+	void
+	buildPlan() {
+		m_plan.entries.clear();
+		m_plan.index.clear();
+		m_plan.ids.clear();
+		m_plan.typeName = name();
+		bool complete = true;
+		PropertyMap::iterator typeName = _properties().find( "__typeInfoName" );
+		if ( typeName != _properties().end() ) {
+			complete = addPlanEntry( typeName->second );
+		}
+		for( PropertyMap::iterator it = _properties().begin(); it != _properties().end(); ++it) {
+			if ( it != typeName ) {
+				complete = addPlanEntry( it->second ) && complete;
+			}
+		}
+		m_plan.built = true;
+		m_plan.complete = complete;
+	}
+
+	// false if the property is pending
+	bool
+	addPlanEntry( Property * prop ) {
+		if ( !prop ) {
+			return true;
+		}
+		if ( prop->isPending() ) {
+			return false;
+		}
+		PlanEntry entry;
+		entry.property = prop;
+		entry.metatype = &prop->metatype();
+		entry.name = prop->name();
+		entry.jsonName = JSONWriter::quoted( entry.name );
+		entry.isTypeName = entry.name == "__typeInfoName";
+		FieldId * fieldId = prop->annotations().getFirst< FieldId >();
+		entry.fieldId = fieldId ? fieldId->id() : derivedFieldId( entry.name );
+		// __typeInfoName is read before the type of an object is known, and
+		// colliding ids would be ambiguous. Both are written by name
+		if ( entry.isTypeName || !m_plan.ids.insert( std::make_pair( entry.fieldId, m_plan.entries.size() ) ).second ) {
+			entry.fieldId = 0;
+		}
+		m_plan.index[ entry.name ] = m_plan.entries.size();
+		m_plan.entries.push_back( entry );
+		return true;
+	}
+
+	// keys are written in plan order, so the entry following the last found is tried first
+	PlanEntry *
+	planEntry( SerializationPlan& plan, const std::string& name, size_t& next ) {
+		if ( next < plan.entries.size() && plan.entries[ next ].name == name ) {
+			return &plan.entries[ next++ ];
+		}
+		std::map< std::string, size_t >::iterator found = plan.index.find( name );
+		if ( found == plan.index.end() ) {
+			return NULL;
+		}
+		next = found->second + 1;
+		return &plan.entries[ found->second ];
+	}
+
+	PlanEntry *
+	planEntry( SerializationPlan& plan, boost::uint32_t fieldId, size_t& next ) {
+		if ( next < plan.entries.size() && plan.entries[ next ].fieldId == fieldId ) {
+			return &plan.entries[ next++ ];
+		}
+		std::map< boost::uint32_t, size_t >::iterator found = plan.ids.find( fieldId );
+		if ( found == plan.ids.end() ) {
+			return NULL;
+		}
+		next = found->second + 1;
+		return &plan.entries[ found->second ];
+	}
+
+	// ids derived from names are above FieldId::maxId and below 2^18, so their tags take three bytes
+	static
+	boost::uint32_t
+	derivedFieldId( const std::string& name ) {
+		boost::uint32_t hash = 2166136261u;
+		for ( std::string::const_iterator it = name.begin(); it != name.end(); ++it ) {
+			hash = ( hash ^ static_cast< unsigned char >( *it ) ) * 16777619u;
+		}
+		return FieldId::maxId + 1 + hash % ( 0x40000 - FieldId::maxId - 1 );
+	}
+
 	const std::type_info&	m_type_info;
 	MethodMap		m_methods;
 	MethodMap		m_ownedMethods;
@@ -611,6 +1492,7 @@ private:
 	Annotations 	m_annotations;
 	Metatype *		m_parentMetatype;
 	Metatype *		m_pointerMetatype;
+	SerializationPlan	m_plan;
 };
 
 //------------------------------------------------------------------------------
@@ -1,13 +1,28 @@
 #ifndef methodH
 #define methodH
 
+#include <typeinfo>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/is_void.hpp>
+#include <boost/type_traits/remove_cv.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/utility/enable_if.hpp>
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+#include <utility>
+#endif
+
 namespace jrtti {
 /**
  * \brief Method abstraction
  */
 class Method {
 public:
-	std::string name() {
+	virtual
+	~Method() {}
+
+	std::string name() const {
 		return _name;
 	}
 
@@ -35,11 +50,297 @@ public:
 		return _annotations;
 	}
 
+	/**
+	 * \brief Number of parameters of the method
+	 * \return the method arity
+	 */
+	virtual
+	size_t
+	arity() const = 0;
+
+	/**
+	 * \brief Type of the method return value
+	 * \return the return type info. typeid( void ) if method returns nothing
+	 */
+	virtual
+	const std::type_info&
+	returnType() const = 0;
+
+	/**
+	 * \brief Type of a method parameter
+	 * \param index zero based parameter position
+	 * \return the parameter type info
+	 * \throw Error if index is out of range
+	 */
+	virtual
+	const std::type_info&
+	parameterType( size_t index ) const = 0;
+
+	/**
+	 * \brief Method signature as a function type
+	 * \return the type info of ReturnT ( Params... )
+	 */
+	virtual
+	const std::type_info&
+	signature() const = 0;
+
+	/**
+	 * \brief Invokes the method with a type erased argument list
+	 *
+	 * Arguments holding exactly the parameter type are passed by reference.
+	 * Other arguments are converted with jrtti_cast into stack storage.
+	 * \param instance the object address where the method will be invoked
+	 * \param args array of count arguments
+	 * \param count number of arguments. Should match arity()
+	 * \return the call result. Empty if method returns void
+	 * \throw Error if count does not match the method arity
+	 */
+	virtual
+	boost::any
+	invoke( void * instance, const boost::any * args, size_t count ) {
+		throw Error( "Method '" + _name + "' can not be invoked dynamically without variadic templates support" );
+	}
+
+protected:
+	void
+	checkArity( size_t count ) const {
+		if ( count != arity() ) {
+			throw Error( "Method '" + _name + "' expects " + numToStr( arity() ) + " arguments" );
+		}
+	}
+
+	void
+	checkParameterIndex( size_t index ) const {
+		if ( index >= arity() ) {
+			throw Error( "Parameter index out of range in method '" + _name + "'" );
+		}
+	}
+
 private:
 	std::string _name;
 	Annotations _annotations;
 };
 
+namespace detail {
+	/**
+	 * Binds a type erased argument to a method parameter of type T.
+	 * Arguments holding exactly the parameter type are referenced in place,
+	 * other ones are converted into local storage. Objects held by pointer
+	 * are always referenced. Objects held by value are copied for non const
+	 * reference parameters.
+	 */
+	template < typename T >
+	class MethodArgument {
+	public:
+		typedef typename boost::remove_cv< typename boost::remove_reference< T >::type >::type ValueT;
+
+		MethodArgument( const boost::any& arg )
+			: m_value( referenced( arg ) )
+		{
+			if ( !m_value ) {
+				m_converted = jrtti_cast< ValueT >( arg );
+				m_value = m_converted.get_ptr();
+			}
+		}
+
+		ValueT&
+		get() {
+			return const_cast< ValueT& >( *m_value );
+		}
+
+	private:
+		static
+		const ValueT *
+		referenced( const boost::any& arg ) {
+			ValueT * const * ptr = boost::any_cast< ValueT * >( &arg );
+			if ( ptr && *ptr ) {
+				return *ptr;
+			}
+			return boost::is_same< T, ValueT& >::value ? NULL : boost::any_cast< ValueT >( &arg );
+		}
+
+		const ValueT *				m_value;
+		boost::optional< ValueT >	m_converted;
+	};
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+	template < size_t... I >
+	struct IndexSequence {};
+
+	template < size_t N, size_t... I >
+	struct MakeIndexSequence : MakeIndexSequence< N - 1, N - 1, I... > {};
+
+	template < size_t... I >
+	struct MakeIndexSequence< 0, I... > {
+		typedef IndexSequence< I... > type;
+	};
+#endif
+}
+
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+/**
+ * \brief Method abstraction with a known signature
+ *
+ * Base of all methods with signature ReturnT ( Params... ) whatever their class is.
+ * Allows to call a method from a type erased instance address.
+ */
+template < class ReturnT, class... Params >
+class SignedMethod : public Method {
+public:
+	/**
+	 * \brief Invokes the method
+	 * \param instance the object address where the method will be invoked
+	 * \param params method parameters
+	 * \return the call result
+	 */
+	virtual
+	ReturnT
+	callInstance( void * instance, Params... params ) = 0;
+
+	size_t
+	arity() const {
+		return sizeof...( Params );
+	}
+
+	const std::type_info&
+	returnType() const {
+		return typeid( ReturnT );
+	}
+
+	const std::type_info&
+	parameterType( size_t index ) const {
+		static const std::type_info * types[] = { &typeid( Params )..., NULL };
+		checkParameterIndex( index );
+		return *types[ index ];
+	}
+
+	const std::type_info&
+	signature() const {
+		return typeid( ReturnT ( Params... ) );
+	}
+};
+
+template < class ClassT, class ReturnT, class... Params >
+class TypedMethod : public SignedMethod< ReturnT, Params... > {
+	typedef boost::function< ReturnT ( ClassT*, Params... ) >					FunctionType;
+	typedef TypedMethod< ClassT, ReturnT, Params... >							MethodType;
+	typedef typename detail::MakeIndexSequence< sizeof...( Params ) >::type	Indexes;
+
+public:
+	MethodType&
+	name(std::string name) {
+		Method::name(name);
+		return *this;
+	}
+
+	MethodType&
+	function(FunctionType f) {
+		_functor = f;
+		return *this;
+	}
+
+	ReturnT
+	call(ClassT * instance, Params... params) {
+		return (ReturnT)_functor( instance, std::forward< Params >( params )... );
+	}
+
+	ReturnT
+	callInstance( void * instance, Params... params ) {
+		return (ReturnT)_functor( static_cast< ClassT * >( instance ), std::forward< Params >( params )... );
+	}
+
+	boost::any
+	invoke( void * instance, const boost::any * args, size_t count ) {
+		this->checkArity( count );
+		return _invoke< ReturnT >( static_cast< ClassT * >( instance ), args, Indexes() );
+	}
+
+private:
+	template < typename R, size_t... I >
+	typename boost::disable_if< boost::is_void< R >, boost::any >::type
+	_invoke( ClassT * instance, const boost::any * args, detail::IndexSequence< I... > ) {
+		return boost::any( _functor( instance, detail::MethodArgument< Params >( args[ I ] ).get()... ) );
+	}
+
+	template < typename R, size_t... I >
+	typename boost::enable_if< boost::is_void< R >, boost::any >::type
+	_invoke( ClassT * instance, const boost::any * args, detail::IndexSequence< I... > ) {
+		_functor( instance, detail::MethodArgument< Params >( args[ I ] ).get()... );
+		return boost::any();
+	}
+
+	FunctionType 	_functor;
+};
+
+template < typename Signature >
+class MethodHandle;
+
+/**
+ * \brief Pre-resolved method invoker
+ *
+ * A method handle is resolved once from a Method whose signature is checked
+ * against ReturnT ( Params... ). Calls through the handle do not look up
+ * the method by name.
+ * Get it with Metatype::methodHandle
+ */
+template < class ReturnT, class... Params >
+class MethodHandle< ReturnT ( Params... ) > {
+public:
+	typedef SignedMethod< ReturnT, Params... >	MethodType;
+
+	/**
+	 * \brief Creates an unresolved handle
+	 */
+	MethodHandle()
+		: m_method( NULL )
+	{}
+
+	/**
+	 * \brief Resolves the handle to a method
+	 * \param method the method to be invoked through this handle
+	 * \throw BadCast if the method signature does not match ReturnT ( Params... )
+	 */
+	explicit
+	MethodHandle( Method& method ) {
+		if ( method.signature() != typeid( ReturnT ( Params... ) ) ) {
+			throw BadCast( "method '" + method.name() + "' with signature " + demangle( method.signature().name() ) );
+		}
+		m_method = static_cast< MethodType * >( &method );
+	}
+
+	/**
+	 * \brief Check if the handle is resolved
+	 * \return true if the handle has a target method
+	 */
+	bool
+	isValid() const {
+		return m_method != NULL;
+	}
+
+	/**
+	 * \brief The target method
+	 * \return the target method. Handle should be resolved
+	 */
+	Method&
+	method() const {
+		return *m_method;
+	}
+
+	/**
+	 * \brief Invokes the target method
+	 * \param instance the object address where the method will be invoked
+	 * \param params method parameters
+	 * \return the call result
+	 */
+	ReturnT
+	operator()( void * instance, Params... params ) const {
+		return m_method->callInstance( instance, std::forward< Params >( params )... );
+	}
+
+private:
+	MethodType * m_method;
+};
+#else
 template <class ClassT, class ReturnT, class Param1=void, class Param2=void>
 class TypedMethod : public Method {
 	typedef boost::function<ReturnT (ClassT*, Param1, Param2)> 	FunctionType;
@@ -60,6 +361,27 @@ public:
 		return (ReturnT)_functor(instance,p1,p2);
 	}
 
+	size_t
+	arity() const {
+		return 2;
+	}
+
+	const std::type_info&
+	returnType() const {
+		return typeid( ReturnT );
+	}
+
+	const std::type_info&
+	parameterType( size_t index ) const {
+		checkParameterIndex( index );
+		return index ? typeid( Param2 ) : typeid( Param1 );
+	}
+
+	const std::type_info&
+	signature() const {
+		return typeid( ReturnT ( Param1, Param2 ) );
+	}
+
 private:
 	FunctionType 	_functor;
 };
@@ -87,6 +409,27 @@ public:
 		return (ReturnT)_functor(instance);
 	}
 
+	size_t
+	arity() const {
+		return 0;
+	}
+
+	const std::type_info&
+	returnType() const {
+		return typeid( ReturnT );
+	}
+
+	const std::type_info&
+	parameterType( size_t index ) const {
+		checkParameterIndex( index );
+		return typeid( void );
+	}
+
+	const std::type_info&
+	signature() const {
+		return typeid( ReturnT () );
+	}
+
 private:
 	FunctionType 	_functor;
 };
@@ -115,10 +458,33 @@ public:
 		return (ReturnT)_functor(instance,p);
 	}
 
+	size_t
+	arity() const {
+		return 1;
+	}
+
+	const std::type_info&
+	returnType() const {
+		return typeid( ReturnT );
+	}
+
+	const std::type_info&
+	parameterType( size_t index ) const {
+		checkParameterIndex( index );
+		return typeid( Param1 );
+	}
+
+	const std::type_info&
+	signature() const {
+		return typeid( ReturnT ( Param1 ) );
+	}
+
 private:
 	FunctionType 	_functor;
 };
 
+#endif
+
 //------------------------------------------------------------------------------
 }; //namespace jrtti
 #endif
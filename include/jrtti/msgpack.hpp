@@ -0,0 +1,527 @@
+#ifndef jrttimsgpackH
+#define jrttimsgpackH
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Writer producing MessagePack
+ *
+ * Objects are encoded as maps keyed by property name and arrays as arrays.
+ * Fundamental values are stored in their smallest MessagePack encoding,
+ * without going through text. Numeric object ids are stored as integers.
+ * MessagePack has no floating point type wider than double, so long double
+ * values are written as double and lose precision where long double is wider.
+ * See Metatype::toMsgPack
+ *
+ * This header is not included by jrtti.hpp. Include it to use
+ * Metatype::toMsgPack and Metatype::fromMsgPack.
+ */
+class MsgPackWriter : public Writer {
+public:
+	/**
+	 * \brief The bytes written so far
+	 *
+	 * Maps of 16 keys or more are given their wider headers here, in a single
+	 * copy of the data, so call it once writing is done.
+	 * \return the MessagePack encoded data
+	 */
+	const std::string&
+	str() const {
+		if ( m_wideMaps.empty() ) {
+			return m_buf;
+		}
+		std::sort( m_wideMaps.begin(), m_wideMaps.end() );
+		m_out.clear();
+		m_out.reserve( m_buf.size() + 4 * m_wideMaps.size() );
+		size_t pos = 0;
+		for ( std::vector< WideMap >::const_iterator it = m_wideMaps.begin(); it != m_wideMaps.end(); ++it ) {
+			m_out.append( m_buf, pos, it->first - pos );
+			m_out += it->second;
+			pos = it->first + 1;
+		}
+		m_out.append( m_buf, pos, std::string::npos );
+		return m_out;
+	}
+
+	// map sizes are not known in advance. A fixmap header is reserved, and
+	// replaced by a wider one in str() if needed, so bodies are not moved per map
+	void
+	beginObject() {
+		m_maps.push_back( OpenMap( m_buf.size() ) );
+		m_buf += char( 0x80 );
+	}
+
+	void
+	writeId( const std::string& id ) {
+		key( "$id" );
+		writeIdValue( id );
+	}
+
+	void
+	key( const std::string& name ) {
+		++m_maps.back().count;
+		writeString( name );
+	}
+
+	void
+	endObject() {
+		OpenMap map = m_maps.back();
+		m_maps.pop_back();
+		if ( map.count < 16 ) {
+			m_buf[ map.header ] = char( 0x80 | map.count );
+		}
+		else {
+			std::string header;
+			if ( map.count < 0x10000 ) {
+				header += char( 0xde );
+				appendBigEndian( header, map.count, 2 );
+			}
+			else {
+				header += char( 0xdf );
+				appendBigEndian( header, map.count, 4 );
+			}
+			m_wideMaps.push_back( WideMap( map.header, header ) );
+		}
+	}
+
+	void
+	beginArray( size_t count ) {
+		if ( count < 16 ) {
+			m_buf += char( 0x90 | count );
+		}
+		else if ( count < 0x10000 ) {
+			m_buf += char( 0xdc );
+			appendBigEndian( m_buf, count, 2 );
+		}
+		else {
+			m_buf += char( 0xdd );
+			appendBigEndian( m_buf, count, 4 );
+		}
+	}
+
+	void
+	endArray() {}
+
+	void
+	writeRef( const std::string& id ) {
+		m_buf += char( 0x81 );
+		writeString( "$ref" );
+		writeIdValue( id );
+	}
+
+	void
+	writeNull() {
+		m_buf += char( 0xc0 );
+	}
+
+	void
+	writeBool( bool value ) {
+		m_buf += char( value ? 0xc3 : 0xc2 );
+	}
+
+	void
+	writeInt( boost::int64_t value ) {
+		if ( value >= 0 ) {
+			writeUnsigned( boost::uint64_t( value ) );
+		}
+		else if ( value >= -32 ) {
+			m_buf += char( value );
+		}
+		else if ( value >= -128 ) {
+			m_buf += char( 0xd0 );
+			m_buf += char( value );
+		}
+		else if ( value >= -32768 ) {
+			m_buf += char( 0xd1 );
+			appendBigEndian( m_buf, boost::uint64_t( value ), 2 );
+		}
+		else if ( value >= -2147483647 - 1 ) {
+			m_buf += char( 0xd2 );
+			appendBigEndian( m_buf, boost::uint64_t( value ), 4 );
+		}
+		else {
+			m_buf += char( 0xd3 );
+			appendBigEndian( m_buf, boost::uint64_t( value ), 8 );
+		}
+	}
+
+	void
+	writeFloat( float value ) {
+		boost::uint32_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		m_buf += char( 0xca );
+		appendBigEndian( m_buf, bits, 4 );
+	}
+
+	void
+	writeDouble( double value ) {
+		boost::uint64_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		m_buf += char( 0xcb );
+		appendBigEndian( m_buf, bits, 8 );
+	}
+
+	void
+	writeString( const std::string& value ) {
+		size_t length = value.length();
+		if ( length < 32 ) {
+			m_buf += char( 0xa0 | length );
+		}
+		else if ( length < 0x100 ) {
+			m_buf += char( 0xd9 );
+			m_buf += char( length );
+		}
+		else if ( length < 0x10000 ) {
+			m_buf += char( 0xda );
+			appendBigEndian( m_buf, length, 2 );
+		}
+		else {
+			m_buf += char( 0xdb );
+			appendBigEndian( m_buf, length, 4 );
+		}
+		m_buf += value;
+	}
+
+private:
+	struct OpenMap {
+		OpenMap( size_t pheader )
+			: header( pheader ),
+			  count( 0 )
+		{}
+
+		size_t	header;	///< position of the map header
+		size_t	count;	///< keys written
+	};
+
+	// position of a fixmap header and the header replacing it
+	typedef std::pair< size_t, std::string > WideMap;
+
+	static
+	void
+	appendBigEndian( std::string& buf, boost::uint64_t value, int bytes ) {
+		while ( bytes-- ) {
+			buf += char( value >> ( bytes * 8 ) );
+		}
+	}
+
+	void
+	writeUnsigned( boost::uint64_t value ) {
+		if ( value < 0x80 ) {
+			m_buf += char( value );
+		}
+		else if ( value < 0x100 ) {
+			m_buf += char( 0xcc );
+			m_buf += char( value );
+		}
+		else if ( value < 0x10000 ) {
+			m_buf += char( 0xcd );
+			appendBigEndian( m_buf, value, 2 );
+		}
+		else if ( value < UINT64_C( 0x100000000 ) ) {
+			m_buf += char( 0xce );
+			appendBigEndian( m_buf, value, 4 );
+		}
+		else {
+			m_buf += char( 0xcf );
+			appendBigEndian( m_buf, value, 8 );
+		}
+	}
+
+	void
+	writeIdValue( const std::string& id ) {
+		if ( !id.empty() && id.length() < 19 && id.find_first_not_of( "0123456789" ) == std::string::npos ) {
+			writeUnsigned( strToNum< boost::uint64_t >( id ) );
+		}
+		else {
+			writeString( id );
+		}
+	}
+
+	std::string				m_buf;
+	std::vector< OpenMap >	m_maps;
+	mutable std::vector< WideMap >	m_wideMaps;	///< headers to widen, sorted by str()
+	mutable std::string		m_out;		///< m_buf with wide headers, built by str()
+};
+
+/**
+ * \brief Reader of MessagePack written by MsgPackWriter
+ *
+ * Numbers are converted between the integer and floating point families as
+ * needed, so readers of the same type with a different numeric property
+ * type still load the values.
+ * See Metatype::fromMsgPack
+ */
+class MsgPackReader : public Reader {
+public:
+	/**
+	 * \brief Constructor
+	 * \param data the MessagePack encoded data. Kept by reference, it must outlive the reader
+	 */
+	MsgPackReader( const std::string& data )
+		: m_data( data ),
+		  m_pos( 0 )
+	{}
+
+	bool
+	readNull() {
+		if ( peek() == 0xc0 ) {
+			++m_pos;
+			return true;
+		}
+		return false;
+	}
+
+	void
+	beginObject() {
+		unsigned char c = next();
+		size_t count;
+		if ( ( c & 0xf0 ) == 0x80 ) {
+			count = c & 0x0f;
+		}
+		else if ( c == 0xde ) {
+			count = size_t( bigEndian( 2 ) );
+		}
+		else if ( c == 0xdf ) {
+			count = size_t( bigEndian( 4 ) );
+		}
+		else {
+			throw mismatch( "map" );
+		}
+		m_remaining.push_back( count );
+	}
+
+	bool
+	nextKey( std::string& key ) {
+		if ( !nextItem() ) {
+			return false;
+		}
+		key = readString();
+		return true;
+	}
+
+	void
+	beginArray() {
+		unsigned char c = next();
+		size_t count;
+		if ( ( c & 0xf0 ) == 0x90 ) {
+			count = c & 0x0f;
+		}
+		else if ( c == 0xdc ) {
+			count = size_t( bigEndian( 2 ) );
+		}
+		else if ( c == 0xdd ) {
+			count = size_t( bigEndian( 4 ) );
+		}
+		else {
+			throw mismatch( "array" );
+		}
+		m_remaining.push_back( count );
+	}
+
+	// elements take one byte at least, so corrupted counts do not reserve huge arrays
+	size_t
+	arraySize() const {
+		return std::min( m_remaining.back(), m_data.length() - m_pos );
+	}
+
+	bool
+	nextElement() {
+		return nextItem();
+	}
+
+	bool
+	readBool() {
+		unsigned char c = next();
+		if ( c == 0xc2 || c == 0xc3 ) {
+			return c == 0xc3;
+		}
+		--m_pos;
+		return readInt() != 0;
+	}
+
+	boost::int64_t
+	readInt() {
+		unsigned char c = next();
+		if ( c < 0x80 ) {
+			return c;
+		}
+		if ( c >= 0xe0 ) {
+			return boost::int64_t( c ) - 0x100;
+		}
+		switch ( c ) {
+			case 0xcc: return boost::int64_t( bigEndian( 1 ) );
+			case 0xcd: return boost::int64_t( bigEndian( 2 ) );
+			case 0xce: return boost::int64_t( bigEndian( 4 ) );
+			case 0xcf: return boost::int64_t( bigEndian( 8 ) );
+			case 0xd0: return boost::int8_t( bigEndian( 1 ) );
+			case 0xd1: return boost::int16_t( bigEndian( 2 ) );
+			case 0xd2: return boost::int32_t( bigEndian( 4 ) );
+			case 0xd3: return boost::int64_t( bigEndian( 8 ) );
+			case 0xca:
+			case 0xcb: {
+				--m_pos;
+				return boost::int64_t( readDouble() );
+			}
+		}
+		throw mismatch( "integer" );
+	}
+
+	double
+	readDouble() {
+		unsigned char c = next();
+		if ( c == 0xca ) {
+			boost::uint32_t bits = boost::uint32_t( bigEndian( 4 ) );
+			float value;
+			memcpy( &value, &bits, sizeof( value ) );
+			return value;
+		}
+		if ( c == 0xcb ) {
+			boost::uint64_t bits = bigEndian( 8 );
+			double value;
+			memcpy( &value, &bits, sizeof( value ) );
+			return value;
+		}
+		--m_pos;
+		return double( readInt() );
+	}
+
+	std::string
+	readString() {
+		unsigned char c = peek();
+		size_t length;
+		if ( ( c & 0xe0 ) == 0xa0 ) {
+			++m_pos;
+			length = c & 0x1f;
+		}
+		else if ( c >= 0xd9 && c <= 0xdb ) {
+			++m_pos;
+			length = size_t( bigEndian( 1 << ( c - 0xd9 ) ) );
+		}
+		else if ( c == 0xc0 ) {
+			++m_pos;
+			return std::string();
+		}
+		else {
+			// numeric ids
+			return numToStr( readInt() );
+		}
+		require( length );
+		std::string result( m_data, m_pos, length );
+		m_pos += length;
+		return result;
+	}
+
+	bool
+	readId( size_t& id, std::string& name ) {
+		unsigned char c = peek();
+		if ( c < 0x80 || ( c >= 0xcc && c <= 0xcf ) ) {
+			id = size_t( readInt() );
+			return true;
+		}
+		return Reader::readId( id, name );
+	}
+
+	void
+	skip() {
+		unsigned char c = peek();
+		if ( ( c & 0xf0 ) == 0x80 || c == 0xde || c == 0xdf ) {
+			beginObject();
+			std::string key;
+			while ( nextKey( key ) ) {
+				skip();
+			}
+		}
+		else if ( ( c & 0xf0 ) == 0x90 || c == 0xdc || c == 0xdd ) {
+			beginArray();
+			while ( nextElement() ) {
+				skip();
+			}
+		}
+		else if ( c == 0xc0 || c == 0xc2 || c == 0xc3 ) {
+			++m_pos;
+		}
+		else if ( c == 0xca || c == 0xcb ) {
+			readDouble();
+		}
+		else if ( ( c & 0xe0 ) == 0xa0 || c == 0xd9 || c == 0xda || c == 0xdb ) {
+			readString();
+		}
+		else {
+			readInt();
+		}
+	}
+
+private:
+	Error
+	mismatch( const std::string& expected ) const {
+		return Error( "MessagePack: " + expected + " expected at position " + numToStr( m_pos - 1 ) );
+	}
+
+	void
+	require( size_t bytes ) const {
+		if ( m_data.length() - m_pos < bytes ) {
+			throw Error( "MessagePack: unexpected end of data" );
+		}
+	}
+
+	unsigned char
+	peek() const {
+		require( 1 );
+		return static_cast< unsigned char >( m_data[ m_pos ] );
+	}
+
+	unsigned char
+	next() {
+		unsigned char c = peek();
+		++m_pos;
+		return c;
+	}
+
+	boost::uint64_t
+	bigEndian( int bytes ) {
+		require( bytes );
+		boost::uint64_t value = 0;
+		while ( bytes-- ) {
+			value = ( value << 8 ) | static_cast< unsigned char >( m_data[ m_pos++ ] );
+		}
+		return value;
+	}
+
+	bool
+	nextItem() {
+		if ( m_remaining.back() == 0 ) {
+			m_remaining.pop_back();
+			return false;
+		}
+		--m_remaining.back();
+		return true;
+	}
+
+	const std::string&		m_data;
+	size_t					m_pos;
+	std::vector< size_t >	m_remaining;	///< items left in the open maps and arrays
+};
+
+inline
+std::string
+Metatype::toMsgPack( const boost::any& instance ) {
+	MsgPackWriter writer;
+	write( instance, writer, true );
+	return writer.str();
+}
+
+inline
+void
+Metatype::fromMsgPack( const boost::any& instance, const std::string& data ) {
+	MsgPackReader reader( data );
+	read( instance, reader );
+}
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttimsgpackH
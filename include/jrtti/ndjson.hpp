@@ -0,0 +1,335 @@
+#ifndef jrttindjsonH
+#define jrttindjsonH
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#ifdef JRTTI_THREADS
+	#include <thread>
+#endif
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Block processing shared by NDJSONWriter and NDJSONReader
+ */
+class NDJSON {
+public:
+	/**
+	 * \brief Default number of threads
+	 * \return the hardware concurrency, or 1 without thread support
+	 */
+	static
+	unsigned
+	defaultThreads() {
+#ifdef JRTTI_THREADS
+		return std::max( 1u, std::thread::hardware_concurrency() );
+#else
+		return 1;
+#endif
+	}
+
+	/**
+	 * \brief Runs a task over count items split in contiguous slices
+	 *
+	 * Each slice runs in its own thread, the first one in the calling
+	 * thread. task( slice, begin, end ) processes the items [begin, end).
+	 * \param task the task to run
+	 * \param count number of items
+	 * \param threads maximum number of slices
+	 * \throw Error if the task failed in any slice
+	 */
+	template< typename Task >
+	static
+	void
+	run( Task& task, size_t count, unsigned threads ) {
+#ifdef JRTTI_THREADS
+		size_t slices = std::min( count, size_t( std::max( 1u, threads ) ) );
+#else
+		size_t slices = std::min( count, size_t( 1 ) );
+#endif
+		std::vector< std::string > errors( slices );
+#ifdef JRTTI_THREADS
+		std::vector< std::thread > workers;
+		workers.reserve( slices );
+		try {
+			for ( size_t slice = 1; slice < slices; ++slice ) {
+				workers.push_back( std::thread( &runSlice< Task >, &task, slice, slices, count, &errors[ slice ] ) );
+			}
+		}
+		catch ( ... ) {
+			// joinable threads can not be destroyed
+			for ( std::vector< std::thread >::iterator it = workers.begin(); it != workers.end(); ++it ) {
+				it->join();
+			}
+			throw;
+		}
+#endif
+		if ( slices ) {
+			runSlice( &task, 0, slices, count, &errors[ 0 ] );
+		}
+#ifdef JRTTI_THREADS
+		for ( std::vector< std::thread >::iterator it = workers.begin(); it != workers.end(); ++it ) {
+			it->join();
+		}
+#endif
+		for ( std::vector< std::string >::iterator it = errors.begin(); it != errors.end(); ++it ) {
+			if ( !it->empty() ) {
+				throw Error( *it );
+			}
+		}
+	}
+
+private:
+	template< typename Task >
+	static
+	void
+	runSlice( Task * task, size_t slice, size_t slices, size_t count, std::string * error ) {
+		// records of a block are private to the reader, observers are not told about them
+		PropertyObserver * observer = PropertyObserver::current();
+		PropertyObserver::current() = NULL;
+		try {
+			( *task )( slice, count * slice / slices, count * ( slice + 1 ) / slices );
+		}
+		catch ( std::exception& e ) {
+			*error = e.what();
+		}
+		catch ( ... ) {
+			*error = "NDJSON: unknown error";
+		}
+		PropertyObserver::current() = observer;
+	}
+};
+
+/**
+ * \brief Writes objects as newline delimited JSON
+ *
+ * Each record is written as the compact JSON text of Metatype::toStr for
+ * streaming, in a single line. Records are collected in blocks, and every
+ * block is formatted by several threads into buffers of their own, which are
+ * written in record order.
+ *
+ * All the types must be declared before writing. Without thread support
+ * blocks are formatted by the calling thread.
+ *
+ * Call flush() after the last record: the destructor can not report errors,
+ * and only sets badbit on the stream if the pending records can not be written.
+ * \sa JRTTI_THREADS
+ */
+template< typename T >
+class NDJSONWriter {
+public:
+	/**
+	 * \brief Constructor
+	 * \param out the stream receiving the lines
+	 * \param blockSize number of records formatted together
+	 * \param threads number of threads formatting a block
+	 * \throw Error if a property type is not declared
+	 */
+	NDJSONWriter( std::ostream& out, size_t blockSize = 4096, unsigned threads = NDJSON::defaultThreads() )
+		: m_type( jrtti::metatype< T >() ),
+		  m_out( out ),
+		  m_blockSize( std::max( blockSize, size_t( 1 ) ) ),
+		  m_threads( threads )
+	{
+		m_block.reserve( m_blockSize );
+		Reflector::instance().prepareSerialization();
+	}
+
+	~NDJSONWriter() {
+		try {
+			flush();
+		}
+		catch ( ... ) {
+			try {
+				m_out.setstate( std::ios_base::badbit );
+			}
+			catch ( ... ) {}
+		}
+	}
+
+	/**
+	 * \brief Appends a record
+	 *
+	 * The record is copied, and written when its block is complete.
+	 * \param record the object to write
+	 */
+	void
+	write( const T& record ) {
+		m_block.push_back( record );
+		if ( m_block.size() >= m_blockSize ) {
+			flush();
+		}
+	}
+
+	/**
+	 * \brief Writes the records of the incomplete block
+	 * \throw Error if a record can not be formatted or out fails
+	 */
+	void
+	flush() {
+		if ( m_block.empty() ) {
+			return;
+		}
+		FormatTask task( m_type, m_block, m_threads );
+		NDJSON::run( task, m_block.size(), m_threads );
+		for ( std::vector< std::string >::iterator it = task.buffers.begin(); it != task.buffers.end(); ++it ) {
+			m_out.write( it->data(), std::streamsize( it->size() ) );
+		}
+		m_block.clear();
+		if ( !m_out ) {
+			throw Error( "NDJSON: error writing records" );
+		}
+	}
+
+private:
+	NDJSONWriter( const NDJSONWriter& );
+	NDJSONWriter& operator = ( const NDJSONWriter& );
+
+	struct FormatTask {
+		FormatTask( Metatype& ptype, std::vector< T >& precords, unsigned threads )
+			: type( ptype ),
+			  records( precords ),
+			  buffers( std::max( 1u, threads ) )
+		{}
+
+		void
+		operator () ( size_t slice, size_t begin, size_t end ) {
+			JSONWriter writer( true );
+			for ( size_t i = begin; i < end; ++i ) {
+				type.write( &records[ i ], writer, true );
+				writer.endLine();
+			}
+			buffers[ slice ] = writer.str();
+		}
+
+		Metatype&					type;
+		std::vector< T >&			records;
+		std::vector< std::string >	buffers;	///< text of each slice
+	};
+
+	Metatype&			m_type;
+	std::ostream&		m_out;
+	size_t				m_blockSize;
+	unsigned			m_threads;
+	std::vector< T >	m_block;
+};
+
+/**
+ * \brief Reads objects from newline delimited JSON
+ *
+ * Reads the lines written by NDJSONWriter, or any JSON object per line
+ * accepted by Metatype::fromStr. Lines are read in blocks, and every block is
+ * parsed by several threads. Records are returned in line order. Blank lines
+ * are skipped.
+ *
+ * All the types must be declared before reading. Without thread support
+ * blocks are parsed by the calling thread.
+ * \sa JRTTI_THREADS
+ */
+template< typename T >
+class NDJSONReader {
+public:
+	/**
+	 * \brief Constructor
+	 * \param in the stream holding the lines
+	 * \param blockSize number of lines parsed together
+	 * \param threads number of threads parsing a block
+	 * \throw Error if a property type is not declared
+	 */
+	NDJSONReader( std::istream& in, size_t blockSize = 4096, unsigned threads = NDJSON::defaultThreads() )
+		: m_type( jrtti::metatype< T >() ),
+		  m_in( in ),
+		  m_blockSize( std::max( blockSize, size_t( 1 ) ) ),
+		  m_threads( threads ),
+		  m_next( 0 ),
+		  m_count( 0 )
+	{
+		Reflector::instance().prepareSerialization();
+	}
+
+	/**
+	 * \brief Reads the next record
+	 * \param record receives the record
+	 * \return false when there are no more records
+	 * \throw Error if a line is not a record
+	 */
+	bool
+	next( T& record ) {
+		if ( m_next == m_block.size() && !readBlock() ) {
+			return false;
+		}
+		std::swap( record, m_block[ m_next++ ] );
+		return true;
+	}
+
+private:
+	NDJSONReader( const NDJSONReader& );
+	NDJSONReader& operator = ( const NDJSONReader& );
+
+	struct ParseTask {
+		ParseTask( Metatype& ptype, std::vector< std::string >& plines, std::vector< T >& precords, size_t pfirst )
+			: type( ptype ),
+			  lines( plines ),
+			  records( precords ),
+			  first( pfirst )
+		{}
+
+		void
+		operator () ( size_t slice, size_t begin, size_t end ) {
+			for ( size_t i = begin; i < end; ++i ) {
+				try {
+					type.fromStr( &records[ i ], lines[ i ] );
+				}
+				catch ( Error& e ) {
+					throw Error( "NDJSON: record " + numToStr( first + i ) + ": " + e.what() );
+				}
+			}
+		}
+
+		Metatype&					type;
+		std::vector< std::string >&	lines;
+		std::vector< T >&			records;
+		size_t						first;	///< number of the first record of the block
+	};
+
+	bool
+	readBlock() {
+		size_t count = 0;
+		while ( count < m_blockSize ) {
+			if ( count == m_lines.size() ) {
+				m_lines.push_back( std::string() );
+			}
+			if ( !std::getline( m_in, m_lines[ count ] ) ) {
+				break;
+			}
+			if ( m_lines[ count ].find_first_not_of( " \t\r" ) != std::string::npos ) {
+				++count;
+			}
+		}
+		m_block.assign( count, T() );
+		m_next = 0;
+		if ( !count ) {
+			return false;
+		}
+		ParseTask task( m_type, m_lines, m_block, m_count );
+		NDJSON::run( task, count, m_threads );
+		m_count += count;
+		return true;
+	}
+
+	Metatype&					m_type;
+	std::istream&				m_in;
+	size_t						m_blockSize;
+	unsigned					m_threads;
+	std::vector< std::string >	m_lines;	///< reused to keep their buffers
+	std::vector< T >			m_block;
+	size_t						m_next;		///< next record of the block to return
+	size_t						m_count;	///< records read before the block
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttindjsonH
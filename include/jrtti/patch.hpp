@@ -0,0 +1,468 @@
+#ifndef jrttipatchH
+#define jrttipatchH
+
+#include <vector>
+#include <map>
+#include <cstring>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Structural difference between two objects of the same type
+ *
+ * A patch is a sequence of replace operations, in JSON Patch style. Each
+ * operation addresses a property by its path, as a JSON pointer like
+ * "/date/place/x", and holds its new value as a JSON string.
+ *
+ * Patches are built with diff, walking both objects through their streamable
+ * properties. Objects referenced from pointers are compared structurally and
+ * walked once, so cycles are handled. When a pointer of the target object
+ * refers to an object already walked, its value is written as a $ref to the
+ * path where the object was found, which is resolved on the patched object
+ * when the patch is applied. POD subtrees without floating point members are
+ * compared with memcmp before walking their properties.
+ */
+class Patch {
+public:
+	/**
+	 * \brief A replace operation
+	 */
+	struct Operation {
+		Operation() {}
+
+		Operation( const std::string& ppath, const std::string& pvalue )
+			: path( ppath ),
+			  value( pvalue )
+		{}
+
+		std::string	path;	///< JSON pointer to the property
+		std::string	value;	///< new value as JSON
+	};
+
+	typedef std::vector< Operation > Operations;
+
+	/**
+	 * \brief Computes the patch transforming an object into another
+	 * \param mt the metatype of both objects
+	 * \param from the original object
+	 * \param to the modified object
+	 * \return the patch that applied to from makes it equal to to
+	 * \throw NullPtrError if any of the objects is a null pointer
+	 */
+	static
+	Patch
+	diff( Metatype& mt, const boost::any& from, const boost::any& to ) {
+		Patch patch;
+		DiffContext ctx;
+		void * pa = mt.get_instance_ptr( from );
+		void * pb = mt.get_instance_ptr( to );
+		if ( !pa || !pb ) {
+			throw NullPtrError( mt.name() );
+		}
+		ctx.visit( mt, pa, pb, "" );
+		patch.diffObject( mt, pa, pb, "", ctx );
+		return patch;
+	}
+
+	/**
+	 * \brief Applies the patch to an object
+	 *
+	 * Operations are applied in order. Pointers replaced by an object value
+	 * point to a newly created object. Previous pointed objects are not
+	 * destroyed, as they are owned by the application.
+	 * \param mt the metatype of instance
+	 * \param instance the object to patch
+	 * \throw Error if a path does not address a declared property
+	 * \throw NullPtrError if a path goes through a null pointer
+	 */
+	void
+	apply( Metatype& mt, const boost::any& instance ) const {
+		void * root = mt.get_instance_ptr( instance );
+		if ( !root ) {
+			throw NullPtrError( mt.name() );
+		}
+		for ( Operations::const_iterator op = m_operations.begin(); op != m_operations.end(); ++op ) {
+			std::vector< std::string > segments = splitPath( op->path );
+			if ( segments.empty() ) {
+				throw Error( "Patch path '" + op->path + "' does not address a property" );
+			}
+			bindRefs( mt, root, op->value );
+			applyOperation( mt, root, segments, 0, op->value );
+		}
+	}
+
+	/**
+	 * \brief The operations of this patch
+	 * \return the operations in application order
+	 */
+	const Operations&
+	operations() const {
+		return m_operations;
+	}
+
+	/**
+	 * \brief Check if patch has no operations
+	 * \return true if the compared objects were equal
+	 */
+	bool
+	empty() const {
+		return m_operations.empty();
+	}
+
+	/**
+	 * \brief Returns a JSON Patch document
+	 *
+	 * Paths are JSON pointers, with ~ and / in property names escaped as ~0
+	 * and ~1 when the patch is built, and are written as JSON strings.
+	 * \return the patch as a JSON array of replace operations
+	 */
+	std::string
+	toStr() const {
+		std::string result = "[";
+		for ( Operations::const_iterator op = m_operations.begin(); op != m_operations.end(); ++op ) {
+			result += op == m_operations.begin() ? "\n" : ",\n";
+			result += "\t{\n\t\t\"op\": \"replace\",\n\t\t\"path\": " + JSONWriter::quoted( op->path ) + ",\n\t\t\"value\": ";
+			for ( std::string::const_iterator c = op->value.begin(); c != op->value.end(); ++c ) {
+				if ( *c == '\n' ) {
+					result += "\n\t\t";
+				}
+				else {
+					result += *c;
+				}
+			}
+			result += "\n\t}";
+		}
+		return result += "\n]";
+	}
+
+	/**
+	 * \brief Builds a patch from a JSON Patch document
+	 * \param str a JSON array of replace operations as returned by toStr
+	 * \return the patch
+	 * \throw Error if an operation is not a replace or the text is not valid
+	 */
+	static
+	Patch
+	fromStr( const std::string& str ) {
+		Patch patch;
+		JSONReader reader( str );
+		reader.beginArray();
+		while ( reader.nextElement() ) {
+			Operation operation;
+			std::string op;
+			std::string key;
+			reader.beginObject();
+			while ( reader.nextKey( key ) ) {
+				if ( key == "op" ) {
+					op = reader.readString();
+				}
+				else if ( key == "path" ) {
+					operation.path = reader.readString();
+				}
+				else if ( key == "value" ) {
+					operation.value = valueText( reader );
+				}
+				else {
+					reader.skip();
+				}
+			}
+			if ( op != "replace" ) {
+				throw Error( "Unsupported patch operation '" + op + "'" );
+			}
+			patch.m_operations.push_back( operation );
+		}
+		return patch;
+	}
+
+private:
+	struct DiffContext {
+		/**
+		 * \brief Pairs the objects a and b, described by mt
+		 *
+		 * Objects are keyed by address and metatype, as a member at offset 0
+		 * has the address of its owner.
+		 * \return false if a or b were already paired
+		 */
+		bool
+		visit( Metatype& mt, void * a, void * b, const std::string& path ) {
+			Metatype * type = &mt._objectType();
+			if ( aToB.find( Metatype::ObjectKey( a, type ) ) != aToB.end() ||
+				 bToA.find( Metatype::ObjectKey( b, type ) ) != bToA.end() ) {
+				return false;
+			}
+			aToB[ Metatype::ObjectKey( a, type ) ] = b;
+			bToA[ Metatype::ObjectKey( b, type ) ] = a;
+			size_t id;
+			if ( !refs.find( b, id ) ) {
+				refs.insert( b, "#" + path );
+			}
+			return true;
+		}
+
+		/**
+		 * \return the object paired with a, or NULL if a was not walked
+		 */
+		void *
+		paired( Metatype& mt, void * a ) {
+			std::map< Metatype::ObjectKey, void * >::iterator it = aToB.find( Metatype::ObjectKey( a, &mt._objectType() ) );
+			return it == aToB.end() ? NULL : it->second;
+		}
+
+		std::map< Metatype::ObjectKey, void * >	aToB;
+		std::map< Metatype::ObjectKey, void * >	bToA;
+		AddressRefMap							refs;	///< objects walked in the modified object and their $ref id
+	};
+
+	void
+	diffObject( Metatype& mt, void * pa, void * pb, const std::string& path, DiffContext& ctx ) {
+		if ( mt._comparesBytes() && memcmp( pa, pb, mt.size() ) == 0 ) {
+			return;
+		}
+		Metatype::SerializationPlan& plan = mt._plan();
+		for( std::vector< Metatype::PlanEntry >::iterator pe = plan.entries.begin(); pe != plan.entries.end(); ++pe ) {
+			Property * prop = pe->property;
+			if ( !prop->isReadable() || !prop->isStreamable() ) {
+				continue;
+			}
+			bool loadable = prop->isWritable() || prop->isForceStreamLoadable();
+			std::string propPath = path + "/" + escapePath( pe->name );
+
+			StringifyDelegateBase * stringifyDelegate = prop->stringifyDelegate();
+			if ( stringifyDelegate ) {
+				std::string value = stringifyDelegate->toStr( pb );
+				if ( loadable && stringifyDelegate->toStr( pa ) != value ) {
+					m_operations.push_back( Operation( propPath, value ) );
+				}
+				continue;
+			}
+
+			Metatype& propType = *pe->metatype;
+			if ( propType.isPointer() ) {
+				boost::any va = prop->get( pa );
+				boost::any vb = prop->get( pb );
+				void * ta = propType.get_instance_ptr( va );
+				void * tb = propType.get_instance_ptr( vb );
+				if ( ta && tb ) {
+					if ( ctx.paired( propType, ta ) == tb ) {
+						continue;
+					}
+					if ( ctx.visit( propType, ta, tb, propPath ) ) {
+						diffObject( propType, ta, tb, propPath, ctx );
+						continue;
+					}
+				}
+				// pointer set, cleared or pointing to a different object
+				if ( loadable && ta != tb ) {
+					m_operations.push_back( Operation( propPath, valueStr( propType, vb, ctx ) ) );
+				}
+				continue;
+			}
+
+			if ( propType.isFundamental() || propType.isCollection() || propType.typeInfo() == typeid( std::string ) ) {
+				boost::any vb = prop->get( pb );
+				if ( loadable && !propType.equals( prop->get( pa ), vb ) ) {
+					m_operations.push_back( Operation( propPath, valueStr( propType, vb, ctx ) ) );
+				}
+				continue;
+			}
+
+			// nested object held by value
+			void * ma = mt.memberInstance( *prop, pa );
+			void * mb = mt.memberInstance( *prop, pb );
+			if ( ma && mb ) {
+				ctx.visit( propType, ma, mb, propPath );
+				diffObject( propType, ma, mb, propPath, ctx );
+			}
+			else {
+				boost::any va = prop->get( pa );
+				boost::any vb = prop->get( pb );
+				void * na = propType.get_instance_ptr( va );
+				void * nb = propType.get_instance_ptr( vb );
+				if ( na && nb ) {
+					diffObject( propType, na, nb, propPath, ctx );
+				}
+			}
+		}
+	}
+
+	std::string
+	valueStr( Metatype& mt, const boost::any& value, DiffContext& ctx ) {
+		AddressRefScope refs( ctx.refs );
+		return mt._toStr( value, true );
+	}
+
+	void
+	applyOperation( Metatype& mt, void * inst, const std::vector< std::string >& segments, size_t index, const std::string& value ) const {
+		Property& prop = mt.property( segments[ index ] );
+		Metatype& propType = prop.metatype();
+		if ( index + 1 == segments.size() ) {
+			if ( propType.isPointer() && !prop.stringifyDelegate() ) {
+				boost::any mod = propType._fromStr( propType.createAsNullPtr(), value );
+				prop.set( inst, boost::move( mod ) );
+			}
+			else {
+				mt.loadProperty( prop, propType, inst, value );
+			}
+			return;
+		}
+
+		if ( propType.isPointer() ) {
+			void * target = propType.get_instance_ptr( prop.get( inst ) );
+			if ( !target ) {
+				throw NullPtrError( segments[ index ] );
+			}
+			applyOperation( propType, target, segments, index + 1, value );
+			prop.notifyChanged( inst );
+			return;
+		}
+		void * member = mt.memberInstance( prop, inst );
+		if ( member ) {
+			applyOperation( propType, member, segments, index + 1, value );
+			prop.notifyChanged( inst );
+		}
+		else {
+			// nested objects returned by value are modified and then moved back
+			boost::any nested = prop.get( inst );
+			applyOperation( propType, propType.get_instance_ptr( nested ), segments, index + 1, value );
+			if ( nested.type() == propType.typeInfo() ) {
+				prop.set( inst, boost::move( nested ) );
+			}
+		}
+	}
+
+	// registers the objects referenced by path from value
+	static
+	void
+	bindRefs( Metatype& mt, void * root, const std::string& value ) {
+		_nameRefMap().clear();
+		std::vector< std::string > ids;
+		JSONReader reader( value );
+		collectRefs( reader, ids );
+		for ( std::vector< std::string >::const_iterator id = ids.begin(); id != ids.end(); ++id ) {
+			if ( !id->empty() && ( *id )[ 0 ] == '#' ) {
+				void * target = resolve( mt, root, splitPath( id->substr( 1 ) ) );
+				if ( target ) {
+					_nameRefMap().add( *id, target );
+				}
+			}
+		}
+	}
+
+	// the $ref ids of the value being read, in document order
+	static
+	void
+	collectRefs( JSONReader& reader, std::vector< std::string >& ids ) {
+		char c = reader.peek();
+		if ( c == '{' ) {
+			std::string key;
+			reader.beginObject();
+			while ( reader.nextKey( key ) ) {
+				if ( key == "$ref" ) {
+					ids.push_back( reader.readString() );
+				}
+				else {
+					collectRefs( reader, ids );
+				}
+			}
+		}
+		else if ( c == '[' ) {
+			reader.beginArray();
+			while ( reader.nextElement() ) {
+				collectRefs( reader, ids );
+			}
+		}
+		else {
+			reader.skip();
+		}
+	}
+
+	// address of the object at path. NULL if it is not addressable
+	static
+	void *
+	resolve( Metatype& mt, void * root, const std::vector< std::string >& segments ) {
+		Metatype * type = &mt;
+		void * inst = root;
+		for ( size_t i = 0; inst && i < segments.size(); ++i ) {
+			Property& prop = type->property( segments[ i ] );
+			Metatype& propType = prop.metatype();
+			if ( propType.isPointer() ) {
+				inst = propType.get_instance_ptr( prop.get( inst ) );
+			}
+			else {
+				inst = type->memberInstance( prop, inst );
+			}
+			type = &propType;
+		}
+		return inst;
+	}
+
+	// the JSON text of the value being read, strings keep their quotes
+	static
+	std::string
+	valueText( JSONReader& reader ) {
+		if ( reader.peek() == '"' ) {
+			return '"' + reader.readStringified() + '"';
+		}
+		return reader.readStringified();
+	}
+
+	static
+	std::string
+	escapePath( const std::string& name ) {
+		std::string result;
+		for ( std::string::const_iterator c = name.begin(); c != name.end(); ++c ) {
+			switch ( *c ) {
+				case '~': result += "~0"; break;
+				case '/': result += "~1"; break;
+				default: result += *c; break;
+			}
+		}
+		return result;
+	}
+
+	static
+	std::vector< std::string >
+	splitPath( const std::string& path ) {
+		std::vector< std::string > segments;
+		size_t pos = 0;
+		while ( pos < path.length() && path[ pos ] == '/' ) {
+			size_t end = path.find( '/', pos + 1 );
+			if ( end == std::string::npos ) {
+				end = path.length();
+			}
+			std::string segment;
+			for ( size_t i = pos + 1; i < end; ++i ) {
+				if ( path[ i ] == '~' && i + 1 < end ) {
+					segment += path[ ++i ] == '1' ? '/' : '~';
+				}
+				else {
+					segment += path[ i ];
+				}
+			}
+			segments.push_back( segment );
+			pos = end;
+		}
+		return segments;
+	}
+
+	Operations	m_operations;
+};
+
+/**
+ * \brief Computes the patch transforming an object into another
+ *
+ * See Patch::diff
+ * \param mt the metatype of both objects
+ * \param from the original object
+ * \param to the modified object
+ * \return the patch that applied to from makes it equal to to
+ */
+inline
+Patch
+diff( Metatype& mt, const boost::any& from, const boost::any& to ) {
+	return Patch::diff( mt, from, to );
+}
+
+}; //namespace jrtti
+#endif  //jrttipatchH
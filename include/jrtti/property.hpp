@@ -4,10 +4,70 @@
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/any.hpp>
+#include <boost/move/utility_core.hpp>
+#include <boost/type_traits/remove_cv.hpp>
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+#include <utility>
+#endif
 #include "annotations.hpp"
 
 namespace jrtti {
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Observer of property changes
+ *
+ * A single observer is installed at a time. It is notified each time a property
+ * is set reflectively and when native code reports a change with notify().
+ *
+ * With thread support each thread has its own observer, notified only of the
+ * changes made by that thread.
+ * \sa JRTTI_THREADS
+ */
+class PropertyObserver
+{
+public:
+	virtual
+	~PropertyObserver() {}
+
+	/**
+	 * \brief Called after a property of instance changed
+	 * \param instance the object address
+	 * \param propertyName the name of the changed property
+	 */
+	virtual
+	void
+	propertyChanged( void * instance, const std::string& propertyName ) = 0;
+
+	/**
+	 * \brief The installed observer
+	 * \return a reference to the observer installed in the calling thread. NULL if none
+	 */
+	static
+	PropertyObserver *&
+	current() {
+#ifdef JRTTI_THREADS
+		static thread_local PropertyObserver * observer = NULL;
+#else
+		static PropertyObserver * observer = NULL;
+#endif
+		return observer;
+	}
+
+	/**
+	 * \brief Notifies a change to the installed observer, if any
+	 * \param instance the object address
+	 * \param propertyName the name of the changed property
+	 */
+	static
+	void
+	notify( void * instance, const std::string& propertyName ) {
+		if ( current() ) {
+			current()->propertyChanged( instance, propertyName );
+		}
+	}
+};
+
 //------------------------------------------------------------------------------
 /**
  * \brief Property abstraction
@@ -20,6 +80,12 @@ public:
 
 	Property() {
     	_mode = (Mode)0;
+		_metaType = NULL;
+		_isDataMember = false;
+		_offset = 0;
+		_size = 0;
+		_alignment = 0;
+		_isTriviallyCopyable = false;
 	}
 
 	/**
@@ -58,6 +124,33 @@ public:
 		return _annotations;
 	}
 
+	/**
+	 * \brief Check if property is streamable
+	 * \return false if property is annotated as NoStreamable
+	 */
+	bool
+	isStreamable() const {
+		return !( _annotations.builtinFlags() & Annotations::NoStreamableFlag );
+	}
+
+	/**
+	 * \brief Check if property is loaded from streams even if it is not writable
+	 * \return true if property is annotated as ForceStreamLoadable
+	 */
+	bool
+	isForceStreamLoadable() const {
+		return ( _annotations.builtinFlags() & Annotations::ForceStreamLoadableFlag ) != 0;
+	}
+
+	/**
+	 * \brief The delegate used to convert the property to and from strings
+	 * \return the StringifyDelegate annotation of this property or NULL if there is none
+	 */
+	StringifyDelegateBase *
+	stringifyDelegate() const {
+		return _annotations.stringifyDelegate();
+	}
+
 	/**
 	 * \brief Retrieves the Metatype of this property
 	 * \return the meta type
@@ -67,6 +160,17 @@ public:
 		return *_metaType;
 	}
 
+	/**
+	 * \brief Check if the Metatype of this property is still unknown
+	 *
+	 * Properties of types not yet declared are pending until its type is declared.
+	 * \return true if property Metatype is not yet available
+	 */
+	bool
+	isPending() const {
+		return _metaType == NULL;
+	}
+
 	/**
 	 * \brief Check if property is readable
 	 *
@@ -111,6 +215,71 @@ public:
 			_mode = (Mode) (_mode | mode);
 	}
 
+	/**
+	 * \brief Check if property is a class data member
+	 *
+	 * Properties declared from a class attribute have a known memory layout
+	 * and can be accessed directly by its address. See offset(), size(),
+	 * alignment() and address()
+	 * \return true if property was declared from a class attribute
+	 */
+	bool
+	isDataMember() const {
+		return _isDataMember;
+	}
+
+	/**
+	 * \brief Byte offset of a data member property
+	 * \return the offset of the data member from the beginning of the object. 0 if not a data member
+	 */
+	size_t
+	offset() const {
+		return _offset;
+	}
+
+	/**
+	 * \brief Size of a data member property
+	 * \return the size in bytes of the data member. 0 if not a data member
+	 */
+	size_t
+	size() const {
+		return _size;
+	}
+
+	/**
+	 * \brief Alignment of a data member property
+	 * \return the alignment requirement in bytes of the data member. 0 if not a data member
+	 */
+	size_t
+	alignment() const {
+		return _alignment;
+	}
+
+	/**
+	 * \brief Check if data member property can be copied with memcpy
+	 * \return true if the data member type is trivially copyable
+	 */
+	bool
+	isTriviallyCopyable() const {
+		return _isTriviallyCopyable;
+	}
+
+	/**
+	 * \brief Address of a data member property
+	 *
+	 * Computes the address of the data member inside instance by pointer
+	 * arithmetic, without calling accessors.
+	 * \param instance the object address
+	 * \return the address of the property value or NULL if property is not a data member
+	 */
+	void *
+	address( void * instance ) const {
+		if ( !_isDataMember || !instance ) {
+			return NULL;
+		}
+		return static_cast< char * >( instance ) + _offset;
+	}
+
 	/**
 	 * \brief Set the property value
 	 * \param instance the object address where to set the property value
@@ -120,6 +289,34 @@ public:
 	void
 	set( void * instance, const boost::any& value ) = 0;
 
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	/**
+	 * \brief Set the property value moving it from a temporary
+	 *
+	 * The value held by the container is moved into the property when
+	 * its type matches the property type, avoiding a deep copy.
+	 * \param instance the object address where to set the property value
+	 * \param value the value to be set. It is left in a valid but unspecified state
+	 */
+	virtual
+	void
+	set( void * instance, boost::any&& value ) {
+		set( instance, static_cast< const boost::any& >( value ) );
+	}
+#endif
+
+	/**
+	 * \brief Notifies the installed PropertyObserver that this property changed
+	 *
+	 * Called by set. Also called when the value changed in place, as when a
+	 * nested path is applied through Metatype::apply.
+	 * \param instance the object address
+	 */
+	void
+	notifyChanged( void * instance ) const {
+		PropertyObserver::notify( instance, _name );
+	}
+
 	/**
 	 * \brief Get the property value in a boost::any container
 	 * \param instance the object address from where to retrieve the property value
@@ -148,11 +345,25 @@ protected:
 		_metaType = mt;
 	}
 
+	void
+	setLayout( size_t offset, size_t size, size_t alignment, bool triviallyCopyable ) {
+		_isDataMember = true;
+		_offset = offset;
+		_size = size;
+		_alignment = alignment;
+		_isTriviallyCopyable = triviallyCopyable;
+	}
+
 private:
 	Annotations	_annotations;
 	Metatype * _metaType;
 	std::string	_name;
 	Mode 	   	_mode;
+	bool		_isDataMember;
+	size_t		_offset;
+	size_t		_size;
+	size_t		_alignment;
+	bool		_isTriviallyCopyable;
 };
 
 template <class ClassT, class PropT>
@@ -160,8 +371,10 @@ class TypedProperty : public Property
 {
 public:
 	typedef typename boost::remove_reference< PropT >::type PropNoRefT;
+	typedef typename boost::remove_cv< PropNoRefT >::type	PropValueT;
 
 	TypedProperty()
+		: m_dataMember( NULL )
 	{
 		try {
 			setMetatype( &jrtti::metatype< PropT >() );
@@ -189,6 +402,8 @@ public:
 		setMode( Readable );
 		m_dataMember = dataMember;
 		m_setter = NULL;
+		setLayout( memberOffset( dataMember ), sizeof( PropNoRefT ),
+				   boost::alignment_of< PropNoRefT >::value, is_trivially_copyable< PropNoRefT >::value );
 		return *this;
 	}
 
@@ -214,16 +429,43 @@ public:
 	void
 	set( void * instance, const boost::any& val)	{
 		if (isWritable()) {
-			PropNoRefT p = jrtti_cast< PropNoRefT >( val );
-			return internal_set( (ClassT *)instance, p );
+			const PropValueT * p = boost::any_cast< PropValueT >( &val );
+			if ( p && m_dataMember ) {
+				*static_cast< PropValueT * >( address( instance ) ) = *p;
+			}
+			else {
+				PropValueT value = p ? *p : jrtti_cast< PropValueT >( val );
+				internal_set( (ClassT *)instance, value );
+			}
+			notifyChanged( instance );
+		}
+	}
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	virtual
+	void
+	set( void * instance, boost::any&& val )	{
+		if (isWritable()) {
+			PropValueT * p = boost::any_cast< PropValueT >( &val );
+			if ( p ) {
+				internal_set( (ClassT *)instance, *p );
+				notifyChanged( instance );
+			}
+			else {
+				set( instance, static_cast< const boost::any& >( val ) );
+			}
 		}
 	}
+#endif
 
 private:
 	//SFINAE for pointers
 	template < typename T>
 	typename boost::enable_if< typename boost::is_pointer< T >::type, boost::any >::type
 	internal_get(void * instance)	{
+		if ( m_dataMember ) {
+			return *static_cast< T * >( address( instance ) );
+		}
 		return  (T)m_getter( (ClassT *)instance );
 	}
 
@@ -240,19 +482,25 @@ private:
 										boost::is_pointer< T >::value,
 										boost::is_reference< T >::value >, boost::any >::type
 	internal_get(void * instance) {
-		PropT res = m_getter( (ClassT *)instance );
-		return res;
+		if ( m_dataMember ) {
+			return *static_cast< T * >( address( instance ) );
+		}
+		return boost::any( m_getter( (ClassT *)instance ) );
 	}
 
+	// value is consumed: it is moved into the data member or setter when possible
 	void
-	internal_set(ClassT * instance, PropT value) {
-		if (m_dataMember)
-		{
-			ClassT * p = static_cast<ClassT *>(instance);
-			p->*m_dataMember = value;
+	internal_set( ClassT * instance, PropValueT& value ) {
+		if ( m_dataMember ) {
+			*static_cast< PropValueT * >( address( instance ) ) = boost::move( value );
+		}
+		else {
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+			m_setter( instance, std::forward< PropT >( value ) );
+#else
+			m_setter( instance, value );
+#endif
 		}
-		else
-			m_setter((ClassT *)instance,(PropT)value);
 	}
 
 	boost::function<void (ClassT*, PropT)>	m_setter;
@@ -278,6 +526,7 @@ public:
 	member( void * ClassT::* dataMember )
 	{
 		m_dataMember = dataMember;
+		setLayout( memberOffset( dataMember ), sizeof( void * ), boost::alignment_of< void * >::value, true );
 		return *this;
 	}
 
@@ -287,6 +536,7 @@ public:
 			throw Error( "pointer required for parameter value" );
 		ClassT * p = static_cast<ClassT *>(instance);
 		p->*m_dataMember = jrtti_cast< void * >( value );
+		notifyChanged( instance );
 	}
 
 	boost::any
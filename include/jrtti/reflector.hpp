@@ -179,6 +179,28 @@ public:
 #endif
 	}
 
+	/**
+	 * \brief Builds the serialization plans of all the metatypes
+	 *
+	 * Plans are built when a metatype is first serialized. Call it once all
+	 * the types are declared, before serializing from several threads.
+	 * \throw Error if a property type is not declared yet, as the property would not be serialized
+	 */
+	void
+	prepareSerialization() {
+		for ( TypeMap::iterator it = _meta_types.begin(); it != _meta_types.end(); ++it ) {
+			if ( it->second->_plan().complete ) {
+				continue;
+			}
+			const Metatype::PropertyMap& props = it->second->properties();
+			for ( Metatype::PropertyMap::const_iterator prop = props.begin(); prop != props.end(); ++prop ) {
+				if ( prop->second && prop->second->isPending() ) {
+					throw Error( "Type of property '" + prop->first + "' of '" + it->second->name() + "' is not declared" );
+				}
+			}
+		}
+	}
+
 	void
 	addPendingProperty( std::string tname, Property * prop ) {
 		m_pendingProperties.insert( PendingProps::value_type( tname, prop ) );
@@ -241,29 +263,51 @@ private:
 	updatePendingProperties( Metatype * mc ) {
 		std::pair< PendingProps::iterator, PendingProps::iterator > ret;
 		ret = m_pendingProperties.equal_range( mc->typeInfo().name() );
+		if ( ret.first == ret.second ) {
+			return;
+		}
 		for ( PendingProps::iterator it = ret.first; it != ret.second; ++it ) {
 			it->second->setMetatype( mc );
 		}
 		m_pendingProperties.erase( ret.first, ret.second );
+		// plans leaving out pending properties are built again on next use
+		for ( TypeMap::iterator it = _meta_types.begin(); it != _meta_types.end(); ++it ) {
+			if ( it->second->m_plan.built && !it->second->m_plan.complete ) {
+				it->second->propertiesChanged();
+			}
+		}
 	}
 
 	friend AddressRefMap& _addressRefMap();
 
+	// reference maps are kept per thread when threads are supported
 	AddressRefMap&
 	_addressRefMap() {
+#ifdef JRTTI_THREADS
+		static thread_local AddressRefMap addressRefs;
+		return addressRefs;
+#else
 		return m_addressRefs;
+#endif
 	}
 
 	friend NameRefMap& _nameRefMap();
 
 	NameRefMap&
 	_nameRefMap() {
+#ifdef JRTTI_THREADS
+		static thread_local NameRefMap nameRefs;
+		return nameRefs;
+#else
 		return m_nameRefs;
+#endif
 	}
 
 	TypeMap						_meta_types;
+#ifndef JRTTI_THREADS
 	AddressRefMap				m_addressRefs;
 	NameRefMap					m_nameRefs;
+#endif
 	std::vector< std::string >	m_prefixDecorators;
 	PendingProps				m_pendingProperties;
 };
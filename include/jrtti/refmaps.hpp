@@ -0,0 +1,299 @@
+#ifndef jrttirefmapsH
+#define jrttirefmapsH
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <string>
+#include <boost/cstdint.hpp>
+
+namespace jrtti {
+
+/**
+ * \brief Ids of the objects already written, by address
+ *
+ * Used while writing to detect objects reached more than once. Objects get
+ * consecutive integer ids in visit order, which are formatted only when they
+ * are written. Addresses are kept in an open addressing hash table with
+ * linear probing.
+ *
+ * An object can be registered with a name, that is written instead of its
+ * integer id.
+ *
+ * A map can be layered over another one, whose objects it finds without
+ * copying them.
+ */
+class AddressRefMap {
+public:
+	AddressRefMap()
+		: m_size( 0 ),
+		  m_base( NULL ),
+		  m_firstId( 0 )
+	{}
+
+	/**
+	 * \brief Removes all the objects
+	 *
+	 * Tables grown by large graphs are released, so clearing costs as
+	 * little as the next write needs.
+	 */
+	void
+	clear() {
+		if ( m_slots.size() > initialCapacity ) {
+			std::vector< Slot >().swap( m_slots );
+		}
+		else if ( m_size ) {
+			m_slots.assign( m_slots.size(), Slot() );
+		}
+		m_size = 0;
+		m_names.clear();
+		m_base = NULL;
+		m_firstId = 0;
+	}
+
+	/**
+	 * \brief Removes all the objects and layers the map over another
+	 *
+	 * The objects of base are found as registered in this map, and objects
+	 * registered afterwards get the ids following those of base, which is not
+	 * modified. base must not change while this map is used.
+	 * \param base the map holding the objects already registered
+	 */
+	void
+	layer( const AddressRefMap& base ) {
+		clear();
+		m_base = &base;
+		m_firstId = base.size();
+	}
+
+	/**
+	 * \brief Exchanges the contents of two maps
+	 * \param other the map to exchange contents with
+	 */
+	void
+	swap( AddressRefMap& other ) {
+		m_slots.swap( other.m_slots );
+		std::swap( m_size, other.m_size );
+		m_names.swap( other.m_names );
+		std::swap( m_base, other.m_base );
+		std::swap( m_firstId, other.m_firstId );
+	}
+
+	/**
+	 * \brief Number of objects registered
+	 * \return the object count, which is also the id of the next object
+	 */
+	size_t
+	size() const {
+		return m_firstId + m_size;
+	}
+
+	/**
+	 * \brief Looks for an object
+	 * \param address the object address
+	 * \param id receives the id of the object if found
+	 * \return true if the object was registered
+	 */
+	bool
+	find( void * address, size_t& id ) const {
+		if ( m_size ) {
+			size_t mask = m_slots.size() - 1;
+			for ( size_t i = hash( address ) & mask; m_slots[ i ].address; i = ( i + 1 ) & mask ) {
+				if ( m_slots[ i ].address == address ) {
+					id = m_slots[ i ].id;
+					return true;
+				}
+			}
+		}
+		return m_base && m_base->find( address, id );
+	}
+
+	/**
+	 * \brief Registers an object not registered yet
+	 * \param address the object address. Not NULL
+	 * \return the id given to the object
+	 */
+	size_t
+	insert( void * address ) {
+		// load factor is kept below one half
+		if ( ( m_size + 1 ) * 2 > m_slots.size() ) {
+			grow();
+		}
+		size_t id = m_firstId + m_size++;
+		place( address, id );
+		return id;
+	}
+
+	/**
+	 * \brief Registers an object not registered yet with a name
+	 * \param address the object address. Not NULL
+	 * \param name the name written as id of the object
+	 * \return the id given to the object
+	 */
+	size_t
+	insert( void * address, const std::string& name ) {
+		size_t id = insert( address );
+		m_names[ id ] = name;
+		return id;
+	}
+
+	/**
+	 * \brief Text written as an object id
+	 * \param id the object id
+	 * \return the name given to the object, or id as a decimal number
+	 */
+	std::string
+	idStr( size_t id ) const {
+		if ( id < m_firstId ) {
+			return m_base->idStr( id );
+		}
+		if ( !m_names.empty() ) {
+			std::map< size_t, std::string >::const_iterator found = m_names.find( id );
+			if ( found != m_names.end() ) {
+				return found->second;
+			}
+		}
+		char digits[ 24 ];
+		char * p = digits + sizeof( digits );
+		do {
+			*--p = char( '0' + id % 10 );
+			id /= 10;
+		} while ( id );
+		return std::string( p, digits + sizeof( digits ) );
+	}
+
+private:
+	static const size_t initialCapacity = 64;
+
+	struct Slot {
+		Slot()
+			: address( NULL ),
+			  id( 0 )
+		{}
+
+		void *	address;	///< NULL for empty slots
+		size_t	id;
+	};
+
+	static
+	size_t
+	hash( void * address ) {
+		// multiplicative hashing, as low address bits are mostly alignment
+		return size_t( ( boost::uint64_t( reinterpret_cast< size_t >( address ) ) * UINT64_C( 0x9e3779b97f4a7c15 ) ) >> 32 );
+	}
+
+	void
+	place( void * address, size_t id ) {
+		size_t mask = m_slots.size() - 1;
+		size_t i = hash( address ) & mask;
+		while ( m_slots[ i ].address ) {
+			i = ( i + 1 ) & mask;
+		}
+		m_slots[ i ].address = address;
+		m_slots[ i ].id = id;
+	}
+
+	void
+	grow() {
+		std::vector< Slot > old;
+		old.swap( m_slots );
+		m_slots.resize( old.empty() ? initialCapacity : old.size() * 2 );
+		for ( std::vector< Slot >::iterator it = old.begin(); it != old.end(); ++it ) {
+			if ( it->address ) {
+				place( it->address, it->id );
+			}
+		}
+	}
+
+	std::vector< Slot >					m_slots;	///< capacity is a power of two
+	size_t								m_size;		///< objects registered in this map
+	std::map< size_t, std::string >		m_names;
+	const AddressRefMap *				m_base;		///< map this one is layered over. NULL if none
+	size_t								m_firstId;	///< size of m_base when layered
+};
+
+/**
+ * \brief Objects already read, by id
+ *
+ * Used while reading to resolve references. Integer ids, as given by
+ * AddressRefMap, index a dense vector. Other ids are kept in a map, as well as
+ * integer ids far beyond the ids seen so far, so malformed data can not
+ * allocate huge vectors.
+ */
+class NameRefMap {
+public:
+	/**
+	 * \brief Removes all the objects
+	 */
+	void
+	clear() {
+		m_objects.clear();
+		m_sparse.clear();
+		m_named.clear();
+	}
+
+	/**
+	 * \brief Registers an object with an integer id
+	 * \param id the object id
+	 * \param address the object address
+	 */
+	void
+	add( size_t id, void * address ) {
+		if ( id < m_objects.size() + maxGap ) {
+			if ( id >= m_objects.size() ) {
+				m_objects.resize( id + 1 );
+			}
+			m_objects[ id ] = address;
+		}
+		else {
+			m_sparse[ id ] = address;
+		}
+	}
+
+	/**
+	 * \brief Registers an object with a name
+	 * \param name the object id
+	 * \param address the object address
+	 */
+	void
+	add( const std::string& name, void * address ) {
+		m_named[ name ] = address;
+	}
+
+	/**
+	 * \brief Looks for an object by integer id
+	 * \param id the object id
+	 * \return the object address or NULL if not found
+	 */
+	void *
+	find( size_t id ) const {
+		// the dense vector may have grown past ids added before to the map
+		if ( id < m_objects.size() && ( m_objects[ id ] || m_sparse.empty() ) ) {
+			return m_objects[ id ];
+		}
+		std::map< size_t, void * >::const_iterator found = m_sparse.find( id );
+		return found == m_sparse.end() ? NULL : found->second;
+	}
+
+	/**
+	 * \brief Looks for an object by name
+	 * \param name the object id
+	 * \return the object address or NULL if not found
+	 */
+	void *
+	find( const std::string& name ) const {
+		std::map< std::string, void * >::const_iterator found = m_named.find( name );
+		return found == m_named.end() ? NULL : found->second;
+	}
+
+private:
+	static const size_t maxGap = 4096;
+
+	std::vector< void * >				m_objects;
+	std::map< size_t, void * >			m_sparse;
+	std::map< std::string, void * >		m_named;
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttirefmapsH
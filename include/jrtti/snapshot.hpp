@@ -0,0 +1,281 @@
+#ifndef jrttisnapshotH
+#define jrttisnapshotH
+
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "jrtti.hpp"
+
+namespace jrtti {
+
+/**
+ * \brief Header of a snapshot file
+ *
+ * A snapshot holds count objects of a POD metatype, stored with their native
+ * layout just after the header. Its size keeps the objects aligned.
+ */
+struct SnapshotHeader {
+	char			signature[ 4 ];
+	boost::uint32_t	objectSize;
+	boost::uint64_t	count;
+	boost::uint64_t	schemaFingerprint;	///< Metatype::schemaFingerprint of the objects
+	boost::uint64_t	reserved;
+
+	static
+	const char *
+	signatureValue() {
+		return "jrs\x01";
+	}
+};
+
+/**
+ * \brief Writes objects of a POD metatype to a snapshot file
+ *
+ * Objects are written as their memory image, so they are read back in place
+ * by SnapshotView. Snapshots depend on the platform byte order and type
+ * sizes.
+ *
+ * This header is not included by jrtti.hpp, as it depends on
+ * boost::interprocess.
+ *
+ * Call close() to know whether the file was written: the destructor closes
+ * it too, but can not report errors.
+ */
+class SnapshotWriter {
+public:
+	/**
+	 * \brief Creates a snapshot file
+	 * \param metatype the metatype of the objects to write
+	 * \param fileName the file to create
+	 * \throw Error if metatype is not POD or the file can not be created
+	 */
+	SnapshotWriter( Metatype& metatype, const std::string& fileName )
+		: m_metatype( metatype )
+	{
+		if ( !metatype.isPOD() ) {
+			throw Error( "Snapshots require a POD metatype. '" + metatype.name() + "' is not POD" );
+		}
+		m_out.open( fileName.c_str(), std::ios::binary | std::ios::trunc );
+		if ( !m_out ) {
+			throw Error( "Can not create snapshot '" + fileName + "'" );
+		}
+		memcpy( m_header.signature, SnapshotHeader::signatureValue(), sizeof( m_header.signature ) );
+		m_header.objectSize = boost::uint32_t( metatype.size() );
+		m_header.count = 0;
+		m_header.schemaFingerprint = metatype.schemaFingerprint();
+		m_header.reserved = 0;
+		m_out.write( reinterpret_cast< const char * >( &m_header ), sizeof( m_header ) );
+	}
+
+	~SnapshotWriter() {
+		try {
+			close();
+		}
+		catch ( ... ) {}
+	}
+
+	/**
+	 * \brief Appends objects to the snapshot
+	 * \param objects address of the first object
+	 * \param count number of contiguous objects to write
+	 */
+	void
+	write( const void * objects, size_t count = 1 ) {
+		m_out.write( static_cast< const char * >( objects ), std::streamsize( count * m_metatype.size() ) );
+		m_header.count += count;
+	}
+
+	/**
+	 * \brief Completes the header and closes the file
+	 * \throw Error if the file could not be written
+	 */
+	void
+	close() {
+		if ( !m_out.is_open() ) {
+			return;
+		}
+		m_out.seekp( 0 );
+		m_out.write( reinterpret_cast< const char * >( &m_header ), sizeof( m_header ) );
+		bool failed = !m_out;
+		m_out.close();
+		if ( failed ) {
+			throw Error( "Error writing snapshot" );
+		}
+	}
+
+private:
+	SnapshotWriter( const SnapshotWriter& );
+	SnapshotWriter& operator = ( const SnapshotWriter& );
+
+	Metatype&		m_metatype;
+	std::ofstream	m_out;
+	SnapshotHeader	m_header;
+};
+
+/**
+ * \brief Read only view of an object stored in a SnapshotView
+ *
+ * Gives access to the object as Metaobject does, without copying it. Property
+ * paths are resolved in place by Metatype::eval, so only the value returned
+ * is copied.
+ */
+class ObjectView {
+public:
+	/**
+	 * \brief Constructor
+	 * \param metatype the metatype of the object
+	 * \param address the address of the object
+	 */
+	ObjectView( Metatype& metatype, const void * address )
+		: m_metatype( &metatype ),
+		  m_address( address )
+	{}
+
+	/**
+	 * \brief Returns the value of property
+	 * \tparam the expected type of the property
+	 * \param name full categorized property name dotted separated. ex: "pont.x"
+	 * \return the property value
+	 */
+	template< typename T >
+	T
+	get( const std::string& name ) const {
+		return m_metatype->eval< T >( instance(), name );
+	}
+
+	/**
+	 * \brief Returns the boost::any value of property
+	 * \param name full categorized property name dotted separated. ex: "pont.x"
+	 * \return the property value
+	 */
+	boost::any
+	get( const std::string& name ) const {
+		return m_metatype->eval( instance(), name );
+	}
+
+	/**
+	 * \brief Retrieves a string representation of the object
+	 * \return the JSON representation as returned by Metatype::toStr
+	 */
+	std::string
+	toStr() const {
+		return m_metatype->toStr( instance() );
+	}
+
+	/**
+	 * \brief Returns the associated Metatype
+	 * \return the associated Metatype
+	 */
+	Metatype&
+	metatype() const {
+		return *m_metatype;
+	}
+
+	/**
+	 * \brief Get the viewed object
+	 * \tparam native type of the object
+	 * \return the object inside the mapped snapshot
+	 */
+	template< typename T >
+	const T *
+	objectInstance() const {
+		if ( typeid( T ) != m_metatype->typeInfo() ) {
+			throw BadCast( m_metatype->name() );
+		}
+		return static_cast< const T * >( m_address );
+	}
+
+private:
+	// the object is not modified through the instance, as views do not set properties
+	boost::any
+	instance() const {
+		return const_cast< void * >( m_address );
+	}
+
+	Metatype *		m_metatype;
+	const void *	m_address;
+};
+
+/**
+ * \brief Read only view of a snapshot file
+ *
+ * Maps a file written by SnapshotWriter in memory. Objects are accessed in
+ * place through ObjectView: nothing is read or constructed until a property
+ * is evaluated, so opening large snapshots takes constant time.
+ *
+ * The file must have been written with the same schema, checked by
+ * Metatype::schemaFingerprint.
+ */
+class SnapshotView {
+public:
+	/**
+	 * \brief Maps a snapshot file
+	 * \param metatype the metatype of the objects in the snapshot
+	 * \param fileName the snapshot file
+	 * \throw Error if the file is not a snapshot of metatype
+	 */
+	SnapshotView( Metatype& metatype, const std::string& fileName )
+		: m_metatype( metatype )
+	{
+		try {
+			boost::interprocess::file_mapping file( fileName.c_str(), boost::interprocess::read_only );
+			boost::interprocess::mapped_region region( file, boost::interprocess::read_only );
+			m_region.swap( region );
+		}
+		catch ( boost::interprocess::interprocess_exception& e ) {
+			throw Error( "Can not map snapshot '" + fileName + "': " + e.what() );
+		}
+
+		if ( m_region.get_size() < sizeof( SnapshotHeader ) ) {
+			throw Error( "'" + fileName + "' is not a snapshot" );
+		}
+		const SnapshotHeader * header = static_cast< const SnapshotHeader * >( m_region.get_address() );
+		if ( memcmp( header->signature, SnapshotHeader::signatureValue(), sizeof( header->signature ) ) != 0 ) {
+			throw Error( "'" + fileName + "' is not a snapshot" );
+		}
+		if ( header->objectSize != metatype.size() || header->schemaFingerprint != metatype.schemaFingerprint() ) {
+			throw Error( "Snapshot '" + fileName + "' was not written with the schema of '" + metatype.name() + "'" );
+		}
+		if ( ( m_region.get_size() - sizeof( SnapshotHeader ) ) / header->objectSize < header->count ) {
+			throw Error( "Snapshot '" + fileName + "' is truncated" );
+		}
+		m_count = size_t( header->count );
+		m_objects = static_cast< const char * >( m_region.get_address() ) + sizeof( SnapshotHeader );
+	}
+
+	/**
+	 * \brief Number of objects in the snapshot
+	 * \return the object count
+	 */
+	size_t
+	size() const {
+		return m_count;
+	}
+
+	/**
+	 * \brief Gets an object of the snapshot
+	 * \param index the object position
+	 * \return a view of the object, valid while the snapshot view lives
+	 * \throw Error if index is out of range
+	 */
+	ObjectView
+	operator [] ( size_t index ) const {
+		if ( index >= m_count ) {
+			throw Error( "Snapshot index " + numToStr( index ) + " out of range" );
+		}
+		return ObjectView( m_metatype, m_objects + index * m_metatype.size() );
+	}
+
+private:
+	SnapshotView( const SnapshotView& );
+	SnapshotView& operator = ( const SnapshotView& );
+
+	Metatype&							m_metatype;
+	boost::interprocess::mapped_region	m_region;
+	const char *						m_objects;
+	size_t								m_count;
+};
+
+//------------------------------------------------------------------------------
+}; //namespace jrtti
+#endif  //jrttisnapshotH
@@ -1,8 +1,13 @@
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <limits>
+#include <set>
 #include <time.h>
 #include <gtest/gtest.h>
 #include "test_jrtti.h"
+#include <jrtti/snapshot.hpp>
+#include <jrtti/msgpack.hpp>
 #include "sample.h"
 
 
@@ -259,6 +264,184 @@ TEST_F(MetaTypeTest, NestedByValMutator) {
 	EXPECT_EQ(3.0, sample.getByValProp().place.x);
 }
 
+TEST_F(MetaTypeTest, dataMemberLayout) {
+	Property& place = jrtti::metatype< Date >()[ "place" ];
+	EXPECT_TRUE( place.isDataMember() );
+	EXPECT_EQ( offsetof( Date, place ), place.offset() );
+	EXPECT_EQ( sizeof( Point ), place.size() );
+	EXPECT_EQ( boost::alignment_of< Point >::value, place.alignment() );
+	EXPECT_TRUE( place.isTriviallyCopyable() );
+
+	Property& y = jrtti::metatype< Point >()[ "y" ];
+	EXPECT_EQ( offsetof( Point, y ), y.offset() );
+	EXPECT_EQ( sizeof( double ), y.size() );
+
+	EXPECT_FALSE( mClass()[ "testDouble" ].isDataMember() );
+	EXPECT_TRUE( mClass()[ "testDouble" ].address( &sample ) == NULL );
+
+	Date d;
+	d.place.x = 7;
+	EXPECT_TRUE( place.address( &d ) == &d.place );
+	jrtti::metatype< Date >().apply( &d, "place.x", 12.0 );
+	EXPECT_EQ( 12, d.place.x );
+	EXPECT_EQ( 12, jrtti::metatype< Date >().eval<double>( &d, "place.x" ) );
+}
+
+TEST_F(MetaTypeTest, podMetatype) {
+	EXPECT_TRUE( jrtti::metatype< Point >().isPOD() );
+	EXPECT_TRUE( jrtti::metatype< double >().isPOD() );
+	EXPECT_FALSE( jrtti::metatype< Date >().isPOD() );		// has padding bytes
+	EXPECT_FALSE( mClass().isPOD() );
+	EXPECT_FALSE( jrtti::metatype< Point * >().isPOD() );
+	EXPECT_EQ( sizeof( Point ), jrtti::metatype< Point >().size() );
+
+	Point p;
+	p.x = 3;
+	p.y = 4;
+	Point * c = jrtti_cast< Point * >( jrtti::metatype< Point >().clone( &p ) );
+	EXPECT_TRUE( p == *c );
+	EXPECT_TRUE( jrtti::metatype< Point >().equals( &p, c ) );
+	c->y = 5;
+	EXPECT_FALSE( jrtti::metatype< Point >().equals( &p, c ) );
+	jrtti::metatype< Point >().copy( c, &p );
+	EXPECT_EQ( 4, c->y );
+	delete c;
+
+	Date d1, d2;
+	d1.d = d2.d = 1;
+	d1.m = d2.m = 2;
+	d1.y = d2.y = 3;
+	EXPECT_TRUE( jrtti::metatype< Date >().equals( &d1, &d2 ) );
+	d2.place.x = 8;
+	EXPECT_FALSE( jrtti::metatype< Date >().equals( &d1, &d2 ) );
+
+	Sample other;
+	sample.getCollection().push_back( d1 );
+	other.getCollection().push_back( d2 );
+	Metatype& colType = mClass()[ "collection" ].metatype();
+	EXPECT_FALSE( colType.equals( &sample.getCollection(), &other.getCollection() ) );
+	other.getCollection()[ 0 ] = d1;
+	EXPECT_TRUE( colType.equals( &sample.getCollection(), &other.getCollection() ) );
+}
+
+struct PodPart {
+	int a;
+	int b;
+};
+
+struct PodWhole {
+	PodPart part;
+	int c;
+};
+
+struct PodAliased {
+	int a;
+	int hidden;
+};
+
+TEST_F(MetaTypeTest, podLayoutChanges) {
+	// floating point members are compared by value, not by bytes
+	Point p, q;
+	p.x = 0.0;
+	q.x = -0.0;
+	p.y = q.y = 1;
+	EXPECT_TRUE( jrtti::metatype< Point >().equals( &p, &q ) );
+	p.x = q.x = std::numeric_limits< double >::quiet_NaN();
+	EXPECT_FALSE( jrtti::metatype< Point >().equals( &p, &q ) );
+
+	// a type is POD again when the type of a member is completed
+	declare< PodPart >()
+		.property( "a", &PodPart::a );
+	Metatype& whole = declare< PodWhole >()
+						.property( "part", &PodWhole::part )
+						.property( "c", &PodWhole::c );
+	EXPECT_FALSE( whole.isPOD() );
+	declare< PodPart >()
+		.property( "b", &PodPart::b );
+	EXPECT_TRUE( whole.isPOD() );
+
+	// bytes described twice leave others undescribed
+	Metatype& aliased = declare< PodAliased >()
+							.property( "a", &PodAliased::a )
+							.property( "alias", &PodAliased::a );
+	EXPECT_FALSE( aliased.isPOD() );
+	PodAliased x = { 1, 2 }, y = { 1, 3 };
+	EXPECT_TRUE( aliased.equals( &x, &y ) );
+}
+
+TEST_F(MetaTypeTest, NestedByValInPlace) {
+	Date d;
+	d.place.x = 5;
+	sample.setByValProp( d );
+
+	// nested objects returned by value are resolved inside the boost::any holding them
+	boost::any byVal = mClass()[ "date" ].get( &sample );
+	Metatype& dateType = jrtti::metatype< Date >();
+	EXPECT_TRUE( dateType.get_instance_ptr( byVal ) == boost::any_cast< Date >( &byVal ) );
+
+	Date * placeHolder = boost::any_cast< Date >( &byVal );
+	placeHolder->place.x = 6;
+	EXPECT_EQ( 6, dateType.eval<double>( byVal, "place.x" ) );
+	EXPECT_EQ( 5, mClass().eval<double>( &sample, "date.place.x" ) );
+
+	mClass().apply( &sample, "date.place.y", 9.0 );
+	EXPECT_EQ( 9, sample.getByValProp().place.y );
+	EXPECT_EQ( 5, sample.getByValProp().place.x );
+
+	mClass().apply( &sample, "refToDate.place.x", 11.0 );
+	EXPECT_EQ( 11, sample.getByRefProp().place.x );
+}
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+struct MoveSink {
+	std::string name;
+	std::string text;
+	void setText( std::string&& t ) { text = std::move( t ); }
+};
+
+struct MoveSinkHolder {
+	MoveSink sink;
+};
+
+TEST_F(MetaTypeTest, moveAwareSet) {
+	declare< MoveSink >()
+		.property( "name", &MoveSink::name )
+		.property( "text", &MoveSink::setText );
+	declare< MoveSinkHolder >()
+		.property( "sink", &MoveSinkHolder::sink );
+	Metatype& mt = metatype< MoveSink >();
+	EXPECT_TRUE( mt[ "text" ].isWritable() );
+	EXPECT_FALSE( mt[ "text" ].isReadable() );
+
+	// long strings own a heap buffer: a moved value keeps it
+	MoveSink sink;
+	boost::any value = std::string( 64, 'a' );
+	const char * buffer = boost::any_cast< std::string >( &value )->data();
+	mt[ "text" ].set( &sink, std::move( value ) );
+	EXPECT_EQ( buffer, sink.text.data() );
+
+	value = std::string( 64, 'b' );
+	buffer = boost::any_cast< std::string >( &value )->data();
+	mt[ "name" ].set( &sink, std::move( value ) );
+	EXPECT_EQ( buffer, sink.name.data() );
+
+	// copies are still taken from lvalues
+	value = std::string( 64, 'c' );
+	mt[ "name" ].set( &sink, value );
+	EXPECT_EQ( std::string( 64, 'c' ), sink.name );
+	EXPECT_NE( boost::any_cast< std::string >( &value )->data(), sink.name.data() );
+
+	MoveSinkHolder holder;
+	value = std::string( 64, 'd' );
+	buffer = boost::any_cast< std::string >( &value )->data();
+	metatype< MoveSinkHolder >().apply( &holder, "sink.text", std::move( value ) );
+	EXPECT_EQ( buffer, holder.sink.text.data() );
+
+	mClass().apply( &sample, "testStr", std::string( 64, 'e' ) );
+	EXPECT_EQ( std::string( 64, 'e' ), sample.getStdStringProp() );
+}
+#endif
+
 TEST_F(MetaTypeTest, testPropsRO) {
 
 	EXPECT_TRUE(mClass()["testDouble"].isReadWrite());
@@ -307,7 +490,7 @@ TEST_F(MetaTypeTest, Serialize) {
 	std::ofstream f("test");
 	f << ss;
 	ss.erase( std::remove_if( ss.begin(), ss.end(), ::isspace ), ss.end() );
-	serialized =             "{\"$id\":\"0\",\"circularRef\":{\"$ref\":\"0\"},\"collection\":{\"properties\":{\"$id\":\"1\"},\"elements\":[{\"$id\":\"2\",\"d\":1,\"m\":4,\"place\":{\"$id\":\"3\",\"x\":98,\"y\":93},\"y\":2012},{\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2013}]},\"date\":{\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2011},\"intAbstract\":34,\"intOverloaded\":87,\"memoryDump\":\"CgsMDQ4=\",\"point\":{\"$id\":\"4\",\"x\":45,\"y\":80},\"refToDate\":{\"$id\":\"5\",\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2011},\"testBool\":true,\"testDouble\":65,\"testRO\":23,\"testStr\":\"Hello,\\\"world\\\"!\\nThisisanewlinewithnonprintablechar\\u0011\"}";
+	serialized =             "{\"$id\":\"0\",\"circularRef\":{\"$ref\":\"0\"},\"collection\":{\"properties\":{\"$id\":\"1\"},\"elements\":[{\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2012},{\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2013}]},\"date\":{\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2011},\"intAbstract\":34,\"intOverloaded\":87,\"memoryDump\":\"CgsMDQ4=\",\"point\":{\"$id\":\"2\",\"x\":45,\"y\":80},\"refToDate\":{\"$id\":\"3\",\"d\":1,\"m\":4,\"place\":{\"x\":98,\"y\":93},\"y\":2011},\"testBool\":true,\"testDouble\":65,\"testRO\":23,\"testStr\":\"Hello,\\\"world\\\"!\\nThisisanewlinewithnonprintablechar\\u0011\"}";
 	EXPECT_EQ( serialized, ss );
 	delete point;
 }
@@ -366,6 +549,36 @@ TEST_F(MetaTypeTest, testMethodAnnotation) {
 	EXPECT_EQ( "method.ico", a->icon() );
 }
 
+TEST_F(MetaTypeTest, builtinAnnotationFlags) {
+	EXPECT_FALSE( mClass()[ "intMember" ].isStreamable() );
+	EXPECT_TRUE( mClass()[ "testDouble" ].isStreamable() );
+	EXPECT_TRUE( mClass()[ "collection" ].isForceStreamLoadable() );
+	EXPECT_FALSE( mClass()[ "intMember" ].isForceStreamLoadable() );
+	EXPECT_TRUE( mClass()[ "memoryDump" ].stringifyDelegate() != NULL );
+	EXPECT_TRUE( mClass()[ "testDouble" ].stringifyDelegate() == NULL );
+
+	// typed lookups are cached and refreshed when annotations are added
+	Annotations copy;
+	GUIAnnotation * gui = new GUIAnnotation( "cached.ico", false, false );
+	{
+		Annotations annotations;
+		EXPECT_TRUE( annotations.getFirst< GUIAnnotation >() == NULL );
+		annotations << gui << new NoStreamable();
+		EXPECT_EQ( gui, annotations.getFirst< GUIAnnotation >() );
+		EXPECT_EQ( gui, annotations.getFirst< Annotation >() );
+		EXPECT_TRUE( annotations.has< NoStreamable >() );
+		EXPECT_EQ( Annotations::NoStreamableFlag, annotations.builtinFlags() );
+		EXPECT_FALSE( annotations.has< ForceStreamLoadable >() );
+		ForceStreamLoadable * loadable = new ForceStreamLoadable();
+		annotations << loadable;
+		EXPECT_EQ( loadable, annotations.getFirst< ForceStreamLoadable >() );
+		EXPECT_EQ( gui, annotations.getFirst< Annotation >() );
+		copy = annotations;
+	}
+	EXPECT_EQ( gui, copy.getFirst< GUIAnnotation >() );
+	EXPECT_EQ( Annotations::NoStreamableFlag | Annotations::ForceStreamLoadableFlag, copy.builtinFlags() );
+}
+
 TEST_F(MetaTypeTest, testCreate) {
 	Point * p = boost::any_cast< Point * >( mClass()[ "point" ].metatype().create() );
 	EXPECT_TRUE( (p->x == -1) && (p->y == -1) );
@@ -392,6 +605,186 @@ TEST_F(MetaTypeTest, testSumMethodCall) {
 	EXPECT_EQ(15.0, result);
 }
 
+#ifndef BOOST_NO_CXX11_VARIADIC_TEMPLATES
+struct Calculator {
+	double weightedSum( int a, double wa, const std::string& label, double b ) {
+		lastLabel = label;
+		return a * wa + b;
+	}
+	void reset() { lastLabel.clear(); }
+	double manhattan( const Point& p ) { return p.x + p.y; }
+	std::string lastLabel;
+};
+
+TEST_F(MetaTypeTest, variadicMethodInvoke) {
+	Metatype& mt = declare< Calculator >()
+		.method( "weightedSum", &Calculator::weightedSum )
+		.method< void >( "reset", &Calculator::reset );
+	Calculator calc;
+
+	EXPECT_EQ( 4, mt.method( "weightedSum" ).arity() );
+	EXPECT_TRUE( mt.method( "weightedSum" ).parameterType( 2 ) == typeid( const std::string& ) );
+	EXPECT_TRUE( mt.method( "weightedSum" ).returnType() == typeid( double ) );
+	EXPECT_TRUE( mt.method( "reset" ).returnType() == typeid( void ) );
+
+	EXPECT_EQ( 7.5, ( mt.call< double, Calculator, int, double, const std::string&, double >( "weightedSum", &calc, 2, 3.0, "typed", 1.5 ) ) );
+	EXPECT_EQ( "typed", calc.lastLabel );
+
+	// arguments are converted to the parameter types
+	boost::any args[] = { 3, 2, std::string( "erased" ), 0.5 };
+	boost::any result = mt.invoke( "weightedSum", &calc, args, 4 );
+	EXPECT_EQ( 6.5, boost::any_cast< double >( result ) );
+	EXPECT_EQ( "erased", calc.lastLabel );
+
+	EXPECT_TRUE( mt.invoke( "reset", &calc ).empty() );
+	EXPECT_TRUE( calc.lastLabel.empty() );
+
+	EXPECT_THROW( mt.invoke( "weightedSum", &calc, args, 3 ), jrtti::Error );
+	EXPECT_THROW( mt.method( "weightedSum" ).parameterType( 4 ), jrtti::Error );
+}
+
+TEST_F(MetaTypeTest, methodHandle) {
+	Metatype& mt = mClass();
+	size_t methodCount = mt.methods().size();
+	EXPECT_TRUE( mt.findMethod( "notDeclared" ) == NULL );
+	EXPECT_THROW( mt.call< void >( "notDeclared", &sample ), jrtti::Error );
+	EXPECT_EQ( methodCount, mt.methods().size() );
+	EXPECT_TRUE( mt.findMethod( "testSum" ) == &mt.method( "testSum" ) );
+
+	MethodHandle< double ( int, double ) > sum = mt.methodHandle< double ( int, double ) >( "testSum" );
+	EXPECT_TRUE( sum.isValid() );
+	EXPECT_EQ( 15.0, sum( &sample, 9, 6.0 ) );
+
+	MethodHandle< int () > intMethod = mt.methodHandle< int () >( "testIntMethod" );
+	EXPECT_EQ( 23, intMethod( &sample ) );
+
+	EXPECT_FALSE( MethodHandle< void () >().isValid() );
+	EXPECT_THROW( mt.methodHandle< double ( double, double ) >( "testSum" ), jrtti::BadCast );
+	EXPECT_THROW( ( mt.call< double, Sample, double, double >( "testSum", &sample, 9, 6 ) ), jrtti::BadCast );
+}
+
+struct RelayArg {
+	RelayArg() : value( 0 ) { ++live; }
+	RelayArg( const RelayArg& other ) : value( other.value ) { ++live; }
+	~RelayArg() { --live; }
+	int value;
+	static int live;
+};
+
+int RelayArg::live = 0;
+
+struct Relay {
+	// relays values above 1 as value - 1, and adds its own value
+	int relay( RelayArg arg ) {
+		if ( arg.value <= 1 ) {
+			return arg.value;
+		}
+		std::string inner = "[ { \"value\": " + jrtti::numToStr( arg.value - 1 ) + " } ]";
+		return arg.value + boost::any_cast< int >( dispatcher->dispatch( id, this, inner ) );
+	}
+	// takes ownership of arg
+	void keep( RelayArg * arg, int factor ) {
+		arg->value *= factor;
+		kept = arg;
+	}
+	Dispatcher * dispatcher;
+	RelayArg * kept;
+	Dispatcher::MethodId id;
+};
+
+TEST_F(MetaTypeTest, dispatcher) {
+	declare< Calculator >()
+		.method( "weightedSum", &Calculator::weightedSum )
+		.method( "manhattan", &Calculator::manhattan );
+	Calculator calc;
+	Dispatcher dispatcher;
+
+	Dispatcher::MethodId sum = dispatcher.resolve( mClass(), "testSum" );
+	EXPECT_EQ( sum, dispatcher.resolve( mClass().name(), "testSum" ) );
+	EXPECT_EQ( "testSum", dispatcher.method( sum ).name() );
+	EXPECT_EQ( 15.0, boost::any_cast< double >( dispatcher.dispatch( sum, &sample, "[ 9, 6.0 ]" ) ) );
+
+	boost::any args[] = { 2, 3.5 };
+	EXPECT_EQ( 5.5, boost::any_cast< double >( dispatcher.dispatch( sum, &sample, args, 2 ) ) );
+
+	std::vector< Dispatcher::Command > commands;
+	commands.push_back( Dispatcher::Command( dispatcher.resolve( "Calculator", "weightedSum" ), &calc, "[ 2, 3, \"batch\", 1 ]" ) );
+	commands.push_back( Dispatcher::Command( dispatcher.resolve( "Calculator", "manhattan" ), &calc, "[ { \"x\": 2, \"y\": 5 } ]" ) );
+	commands.push_back( Dispatcher::Command( sum, &sample, "[ 1, 1 ]" ) );
+	std::vector< boost::any > results;
+	dispatcher.dispatch( commands, results );
+	ASSERT_EQ( 3, results.size() );
+	EXPECT_EQ( 7.0, boost::any_cast< double >( results[ 0 ] ) );
+	EXPECT_EQ( "batch", calc.lastLabel );
+	EXPECT_EQ( 7.0, boost::any_cast< double >( results[ 1 ] ) );
+	EXPECT_EQ( 2.0, boost::any_cast< double >( results[ 2 ] ) );
+
+	EXPECT_THROW( dispatcher.dispatch( sum, &sample, "[ 1 ]" ), jrtti::Error );
+	EXPECT_THROW( dispatcher.dispatch( sum, &sample, "[ 1, 2, 3 ]" ), jrtti::Error );
+	EXPECT_THROW( dispatcher.dispatch( 100, &sample, "[]" ), jrtti::Error );
+	EXPECT_THROW( dispatcher.resolve( "Calculator", "notDeclared" ), jrtti::Error );
+
+	// methods can dispatch again, arguments of the outer call are kept
+	declare< RelayArg >()
+		.property( "value", &RelayArg::value );
+	declare< Relay >()
+		.method( "relay", &Relay::relay )
+		.method( "keep", &Relay::keep );
+	Relay relay;
+	relay.dispatcher = &dispatcher;
+	relay.id = dispatcher.resolve( "Relay", "relay" );
+	EXPECT_EQ( 6, boost::any_cast< int >( dispatcher.dispatch( relay.id, &relay, "[ { \"value\": 3 } ]" ) ) );
+	EXPECT_EQ( 0, RelayArg::live );
+
+	// objects passed by pointer are kept by the method, or destroyed if the call fails
+	Dispatcher::MethodId keep = dispatcher.resolve( "Relay", "keep" );
+	EXPECT_THROW( dispatcher.dispatch( keep, &relay, "[ { \"value\": 3 }, 2, 1 ]" ), jrtti::Error );
+	EXPECT_EQ( 0, RelayArg::live );
+	dispatcher.dispatch( keep, &relay, "[ { \"value\": 3 }, 2 ]" );
+	EXPECT_EQ( 1, RelayArg::live );
+	EXPECT_EQ( 6, relay.kept->value );
+	delete relay.kept;
+}
+
+struct Tally {
+	Tally( int pvalue = 0 ) : value( pvalue ) {}
+	int scaled( int factor ) { return value * factor; }
+	void bump() {
+		if ( value < 0 ) throw std::runtime_error( "negative" );
+		++value;
+	}
+	int value;
+};
+
+TEST_F(MetaTypeTest, invokeAll) {
+	declare< Tally >()
+		.property( "value", &Tally::value )
+		.method( "scaled", &Tally::scaled )
+		.method( "bump", &Tally::bump );
+	Metacollection< std::vector< Tally > >& mt = declareCollection< std::vector< Tally > >();
+
+	std::vector< Tally > tallies;
+	for ( int i = 0; i < 1000; ++i ) {
+		tallies.push_back( Tally( i ) );
+	}
+
+	std::vector< int > results = mt.invokeAll< int >( &tallies, "scaled", 3 );
+	ASSERT_EQ( tallies.size(), results.size() );
+	EXPECT_EQ( 2997, results.back() );
+
+	std::vector< int > parallel = mt.invokeAll< int >( ExecutionPolicy::parallel( 4 ), &tallies, "scaled", 3 );
+	EXPECT_TRUE( results == parallel );
+
+	mt.invokeAll< void >( ExecutionPolicy::parallel( 3 ), &tallies, "bump" );
+	EXPECT_EQ( 1, tallies.front().value );
+	EXPECT_EQ( 1000, tallies.back().value );
+
+	tallies[ 500 ].value = -1;
+	EXPECT_THROW( mt.invokeAll< void >( ExecutionPolicy::parallel( 4 ), &tallies, "bump" ), std::runtime_error );
+	EXPECT_THROW( mt.invokeAll< int >( &tallies, "scaled", 3.0 ), jrtti::BadCast );
+}
+#endif
+
 TEST_F(MetaTypeTest, base64) {
 	const int length = 0xffff;
 	uint8_t * p = new uint8_t[length];
@@ -539,6 +932,1118 @@ TEST_F(MetaTypeTest, untypedProperty) {
 	EXPECT_EQ( sample.getByRefProp().place.y, 3 );
 }
 
+struct PlanSubject {
+	int a;
+	int b;
+	int c;
+};
+
+TEST_F(MetaTypeTest, serializationPlan) {
+	Metatype& mt = declare< PlanSubject >()
+						.property( "a", &PlanSubject::a )
+						.property( "c", &PlanSubject::c );
+	PlanSubject subject = { 1, 2, 3 };
+
+	std::string s = mt.toStr( &subject );
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"a\":1,\"c\":3}", s );
+
+	// plan is rebuilt when properties change
+	declare< PlanSubject >().property( "b", &PlanSubject::b );
+	s = mt.toStr( &subject );
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"a\":1,\"b\":2,\"c\":3}", s );
+
+	mt.deleteProperty( "a" );
+	s = mt.toStr( &subject );
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"b\":2,\"c\":3}", s );
+
+	// unknown keys are skipped without adding properties
+	PlanSubject loaded = { 0, 0, 0 };
+	mt.fromStr( &loaded, "{ \"c\": 6, \"a\": 4, \"unknown\": 9, \"b\": 5 }" );
+	EXPECT_EQ( 0, loaded.a );
+	EXPECT_EQ( 5, loaded.b );
+	EXPECT_EQ( 6, loaded.c );
+	EXPECT_EQ( 2u, mt.properties().size() );
+}
+
+struct PendingPart {
+	int value;
+};
+
+struct PendingOwner {
+	int id;
+	PendingPart part;
+	PendingOwner * self;
+};
+
+TEST_F(MetaTypeTest, serializationPlanPending) {
+	Metatype& mt = declare< PendingOwner >()
+						.property( "id", &PendingOwner::id )
+						.property( "part", &PendingOwner::part )
+						.property( "self", &PendingOwner::self );
+	PendingOwner owner, other;
+	owner.id = 1;
+	owner.part.value = 2;
+	owner.self = &other;
+	other.id = 3;
+	other.part.value = 4;
+	other.self = &owner;
+
+	// pending properties are left out, the plan is kept while objects recurse into it
+	std::string s = mt.toStr( &owner );
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"id\":1,\"self\":{\"id\":3,\"self\":{}}}", s );
+	EXPECT_THROW( Reflector::instance().prepareSerialization(), jrtti::Error );
+
+	// and included once their type is declared
+	declare< PendingPart >()
+		.property( "value", &PendingPart::value );
+	s = mt.toStr( &owner );
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"id\":1,\"part\":{\"value\":2},\"self\":{\"id\":3,\"part\":{\"value\":4},\"self\":{}}}", s );
+	Reflector::instance().prepareSerialization();
+}
+
+struct TrackedState {
+	void rename( const std::string& newLabel ) {
+		label = newLabel;
+		jrtti::markChanged( this, "label" );
+	}
+	int counter;
+	std::string label;
+	Point position;
+};
+
+TEST_F(MetaTypeTest, changeTracker) {
+	Metatype& mt = declare< TrackedState >()
+						.property( "counter", &TrackedState::counter )
+						.property( "label", &TrackedState::label )
+						.property( "position", &TrackedState::position );
+	TrackedState state;
+	state.counter = 1;
+	state.label = "initial";
+
+	ChangeTracker tracker;
+	tracker.track( mt, &state );
+	EXPECT_FALSE( tracker.isChanged( &state ) );
+	EXPECT_EQ( mt.toStr( &state ), tracker.toStr( &state ) );
+
+	mt[ "counter" ].set( &state, 5 );
+	mt.apply( &state, "position.x", 3.0 );
+	state.rename( "renamed" );
+	EXPECT_EQ( 3u, tracker.changes( &state ).size() );
+	EXPECT_EQ( mt.toStr( &state ), tracker.toStr( &state ) );
+
+	tracker.snapshot( &state );
+	mt[ "counter" ].set( &state, 7 );
+	std::string patch = tracker.changesToStr( &state );
+	std::string s = patch;
+	s.erase( std::remove_if( s.begin(), s.end(), ::isspace ), s.end() );
+	EXPECT_EQ( "{\"counter\":7}", s );
+
+	TrackedState replica = state;
+	replica.counter = 0;
+	mt.fromStr( &replica, patch );
+	EXPECT_EQ( 7, replica.counter );
+
+	tracker.untrack( &state );
+	EXPECT_THROW( tracker.toStr( &state ), jrtti::Error );
+
+	// objects reached through pointers notify themselves, not the tracked owner
+	Point * point = new Point();
+	sample.setByPtrProp( point );
+	tracker.track( mClass(), &sample );
+	tracker.toStr( &sample );
+	metatype< Point >().apply( point, "x", 5.0 );
+	EXPECT_EQ( mClass().toStr( &sample ), tracker.toStr( &sample ) );
+
+	// ids are unique in the document, and the references of an enclosing write are kept
+	std::string expected = mClass().toStr( &sample, true );
+	_addressRefMap().clear();
+	_addressRefMap().insert( &replica );
+	EXPECT_EQ( expected, tracker.toStr( &sample, true ) );
+	size_t id;
+	EXPECT_TRUE( _addressRefMap().find( &replica, id ) );
+	EXPECT_EQ( 1u, _addressRefMap().size() );
+	delete point;
+}
+
+struct PatchNode {
+	PatchNode( int pid = 0 ) : id( pid ), next( NULL ) {}
+	int id;
+	std::string name;
+	Point position;
+	PatchNode * next;
+};
+
+TEST_F(MetaTypeTest, diffAndPatch) {
+	Metatype& mt = declare< PatchNode >()
+						.property( "id", &PatchNode::id )
+						.property( "name", &PatchNode::name )
+						.property( "position", &PatchNode::position )
+						.property( "next", &PatchNode::next );
+	PatchNode a( 1 ), a2( 2 );
+	a.name = "one";
+	a.next = &a2;
+	a2.next = &a;
+
+	PatchNode b( a ), b2( a2 );
+	b.next = &b2;
+	b2.next = &b;
+	EXPECT_TRUE( diff( mt, &a, &b ).empty() );
+
+	b.name = "uno";
+	b.position.x = 5;
+	b2.id = 3;
+	Patch patch = diff( mt, &a, &b );
+	ASSERT_EQ( 3u, patch.operations().size() );
+	EXPECT_EQ( "/name", patch.operations()[ 0 ].path );
+	EXPECT_EQ( "/next/id", patch.operations()[ 1 ].path );
+	EXPECT_EQ( "/position/x", patch.operations()[ 2 ].path );
+
+	Patch::fromStr( patch.toStr() ).apply( mt, &a );
+	EXPECT_EQ( "uno", a.name );
+	EXPECT_EQ( 5, a.position.x );
+	EXPECT_EQ( 3, a2.id );
+	EXPECT_EQ( &a2, a.next );
+	EXPECT_TRUE( diff( mt, &a, &b ).empty() );
+
+	// pointers to already walked objects are patched as references
+	b2.next = &b2;
+	patch = diff( mt, &a, &b );
+	ASSERT_EQ( 1u, patch.operations().size() );
+	Patch::fromStr( patch.toStr() ).apply( mt, &a );
+	EXPECT_EQ( &a2, a2.next );
+
+	b2.next = NULL;
+	diff( mt, &a, &b ).apply( mt, &a );
+	EXPECT_TRUE( a2.next == NULL );
+}
+
+struct PatchPart {
+	PatchPart() : value( 0 ) {}
+	int value;
+};
+
+struct PatchWhole {
+	PatchWhole() : part( NULL ) {}
+	PatchPart	first;	// at offset 0, not described
+	PatchPart *	part;
+};
+
+TEST_F(MetaTypeTest, patchMemberAtOwnerAddress) {
+	declare< PatchPart >()
+		.property( "value", &PatchPart::value );
+	Metatype& mt = declare< PatchWhole >()
+						.property( "part", &PatchWhole::part );
+	PatchWhole a, b;
+	a.part = &a.first;
+	b.part = &b.first;
+	b.first.value = 4;
+
+	// the part is not mistaken for its owner, walked at the same address
+	Patch patch = diff( mt, &a, &b );
+	ASSERT_EQ( 1u, patch.operations().size() );
+	EXPECT_EQ( "/part/value", patch.operations()[ 0 ].path );
+	patch.apply( mt, &a );
+	EXPECT_EQ( 4, a.first.value );
+}
+
+struct PatchKeys {
+	PatchKeys() : value( 0 ) {}
+	int value;
+	std::string text;
+};
+
+TEST_F(MetaTypeTest, patchEscaping) {
+	Metatype& mt = declare< PatchKeys >()
+						.property( "a/\"b~", &PatchKeys::value )
+						.property( "text", &PatchKeys::text );
+	PatchKeys a, b;
+	b.value = 7;
+	b.text = "say \"$ref\": \"#/x\", [1]";
+	Patch patch = diff( mt, &a, &b );
+	ASSERT_EQ( 2u, patch.operations().size() );
+	EXPECT_EQ( "/a~1\"b~0", patch.operations()[ 0 ].path );
+
+	Patch::fromStr( patch.toStr() ).apply( mt, &a );
+	EXPECT_EQ( 7, a.value );
+	EXPECT_EQ( b.text, a.text );
+	EXPECT_THROW( Patch::fromStr( "[ { \"op\": \"remove\", \"path\": \"/text\" } ]" ), jrtti::Error );
+}
+
+struct HashedNode {
+	HashedNode() : weight( 1.5 ), next( NULL ) {}
+	double weight;
+	std::string name;
+	std::vector< int > values;
+	HashedNode * next;
+};
+
+TEST_F(MetaTypeTest, fingerprint) {
+	declareCollection< std::vector< int > >();
+	Metatype& mt = declare< HashedNode >()
+						.property( "weight", &HashedNode::weight )
+						.property( "name", &HashedNode::name )
+						.property( "values", &HashedNode::values )
+						.property( "next", &HashedNode::next );
+	HashedNode a, b;
+	a.name = b.name = "node";
+	a.next = &a;
+	b.next = &b;
+	Fingerprint::Value fp = mt.fingerprint( &a );
+	EXPECT_EQ( fp, mt.fingerprint( &b ) );
+
+	b.values.push_back( 1 );
+	EXPECT_NE( fp, mt.fingerprint( &b ) );
+	b.values.clear();
+	b.name = "nodf";
+	EXPECT_NE( fp, mt.fingerprint( &b ) );
+	b.name = "node";
+	b.next = NULL;
+	EXPECT_NE( fp, mt.fingerprint( &b ) );
+	b.next = &b;
+	EXPECT_EQ( fp, mt.fingerprint( &b ) );
+
+	// non streamable properties are not hashed
+	Sample sample;
+	sample.intMember = 1;
+	sample.setDoubleProp( 1.0 );
+	fp = mClass().fingerprint( &sample );
+	sample.intMember = 2;
+	EXPECT_EQ( fp, mClass().fingerprint( &sample ) );
+	sample.setDoubleProp( 2.0 );
+	EXPECT_NE( fp, mClass().fingerprint( &sample ) );
+}
+
+struct CloneNode {
+	CloneNode( int pid = 0 ) : id( pid ), next( NULL ), other( NULL ) {}
+	int id;
+	std::string name;
+	Point position;
+	CloneNode * next;
+	CloneNode * other;
+	std::vector< CloneNode * > children;
+};
+
+TEST_F(MetaTypeTest, deepCloneAndEquals) {
+	declareCollection< std::vector< CloneNode * > >();
+	Metatype& mt = declare< CloneNode >()
+						.property( "id", &CloneNode::id )
+						.property( "name", &CloneNode::name )
+						.property( "position", &CloneNode::position )
+						.property( "next", &CloneNode::next )
+						.property( "other", &CloneNode::other )
+						.property( "children", &CloneNode::children );
+	CloneNode root( 1 ), n2( 2 ), n3( 3 );
+	root.name = "root";
+	root.position.x = 4;
+	root.next = &n2;
+	root.other = &n2;
+	n2.next = &root;
+	root.children.push_back( &n3 );
+	root.children.push_back( &n2 );
+
+	CloneNode * copy = jrtti_cast< CloneNode * >( mt.deepClone( &root ) );
+	ASSERT_TRUE( copy && copy != &root );
+	EXPECT_EQ( "root", copy->name );
+	EXPECT_EQ( 4, copy->position.x );
+	EXPECT_TRUE( copy->next != &n2 );
+	EXPECT_EQ( 2, copy->next->id );
+	EXPECT_EQ( copy->next, copy->other );
+	EXPECT_EQ( copy, copy->next->next );
+	ASSERT_EQ( 2u, copy->children.size() );
+	EXPECT_TRUE( copy->children[ 0 ] != &n3 );
+	EXPECT_EQ( 3, copy->children[ 0 ]->id );
+	EXPECT_EQ( copy->next, copy->children[ 1 ] );
+
+	EXPECT_TRUE( mt.deepEquals( &root, copy ) );
+	copy->children[ 0 ]->id = 9;
+	EXPECT_FALSE( mt.deepEquals( &root, copy ) );
+	copy->children[ 0 ]->id = 3;
+
+	// equal contents but different sharing
+	CloneNode separate( *copy->next );
+	copy->other = &separate;
+	EXPECT_FALSE( mt.deepEquals( &root, copy ) );
+
+	delete copy->children[ 0 ];
+	delete copy->next;
+	delete copy;
+}
+
+TEST_F(MetaTypeTest, graphSnapshot) {
+	declareCollection< std::vector< CloneNode * > >();
+	Metatype& mt = declare< CloneNode >()
+						.property( "id", &CloneNode::id )
+						.property( "name", &CloneNode::name )
+						.property( "position", &CloneNode::position )
+						.property( "next", &CloneNode::next )
+						.property( "other", &CloneNode::other )
+						.property( "children", &CloneNode::children );
+	// a chain too long to be walked recursively, pointing back to its root
+	const int length = 50000;
+	CloneNode root( 0 );
+	CloneNode * last = &root;
+	for ( int i = 1; i <= length; ++i ) {
+		last->next = new CloneNode( i );
+		last = last->next;
+		last->name = "node" + numToStr( i );
+		last->other = &root;
+	}
+	root.children.push_back( root.next->next );
+	root.children.push_back( NULL );
+	root.children.push_back( root.next->next );
+
+	std::string data = GraphSnapshot::save( mt, &root );
+	CloneNode loaded;
+	GraphSnapshot::load( mt, &loaded, data );
+	int count = 0;
+	bool linked = true;
+	for ( CloneNode * node = loaded.next; node; node = node->next ) {
+		++count;
+		linked = linked && node->id == count && node->name == "node" + numToStr( count ) && node->other == &loaded;
+	}
+	EXPECT_EQ( length, count );
+	EXPECT_TRUE( linked );
+	ASSERT_EQ( 3u, loaded.children.size() );
+	EXPECT_EQ( loaded.next->next, loaded.children[ 0 ] );
+	EXPECT_EQ( NULL, loaded.children[ 1 ] );
+	EXPECT_EQ( loaded.children[ 0 ], loaded.children[ 2 ] );
+	EXPECT_THROW( GraphSnapshot::load( mt, &loaded, data.substr( 0, data.length() / 2 ) ), jrtti::Error );
+	Point point;
+	EXPECT_THROW( GraphSnapshot::load( metatype< Point >(), &point, data ), jrtti::Error );
+
+	for ( CloneNode * node = root.next; node; ) {
+		CloneNode * next = node->next;
+		delete node;
+		node = next;
+	}
+	for ( CloneNode * node = loaded.next; node; ) {
+		CloneNode * next = node->next;
+		delete node;
+		node = next;
+	}
+}
+
+struct LiveNode {
+	LiveNode() : value( 0 ), next( NULL ) { ++live; }
+	~LiveNode() { --live; }
+	int getValue() { return value; }
+	void setValue( int v ) {
+		if ( v < 0 ) {
+			throw jrtti::Error( "negative value" );
+		}
+		value = v;
+	}
+	int value;
+	LiveNode * next;
+	static int live;
+};
+
+int LiveNode::live = 0;
+
+struct FocusHolder {
+	Point origin;
+};
+
+struct FocusPair {
+	Point * focus;
+	FocusHolder * holder;
+};
+
+TEST_F(MetaTypeTest, graphSnapshotErrors) {
+	Metatype& mt = declare< LiveNode >()
+						.property( "value", &LiveNode::setValue, &LiveNode::getValue )
+						.property( "next", &LiveNode::next );
+	LiveNode * root = new LiveNode();
+	root->next = new LiveNode();
+	root->next->next = new LiveNode();
+	root->next->next->value = -1;
+	std::string data = GraphSnapshot::save( mt, root );
+	int live = LiveNode::live;
+	LiveNode loaded;
+	EXPECT_THROW( GraphSnapshot::load( mt, &loaded, data ), jrtti::Error );
+	EXPECT_EQ( live + 1, LiveNode::live );
+	delete root->next->next;
+	delete root->next;
+	delete root;
+
+	// a pointer to the first member of an object is not a pointer to the object
+	declare< FocusHolder >()
+		.property( "origin", &FocusHolder::origin );
+	Metatype& pairType = declare< FocusPair >()
+							.property( "focus", &FocusPair::focus )
+							.property( "holder", &FocusPair::holder );
+	FocusHolder holder;
+	holder.origin.x = 4;
+	FocusPair pair;
+	pair.focus = &holder.origin;
+	pair.holder = &holder;
+	FocusPair loadedPair;
+	GraphSnapshot::load( pairType, &loadedPair, GraphSnapshot::save( pairType, &pair ) );
+	EXPECT_EQ( 4, loadedPair.focus->x );
+	EXPECT_EQ( 4, loadedPair.holder->origin.x );
+	EXPECT_NE( ( void * ) loadedPair.focus, ( void * ) loadedPair.holder );
+	delete loadedPair.focus;
+	delete loadedPair.holder;
+}
+
+TEST_F(MetaTypeTest, refMaps) {
+	std::vector< int > objects( 10000 );
+	AddressRefMap addresses;
+	for ( size_t i = 0; i < objects.size(); ++i ) {
+		EXPECT_EQ( i, addresses.insert( &objects[ i ] ) );
+	}
+	bool found = true;
+	for ( size_t i = 0; i < objects.size(); ++i ) {
+		size_t id = 0;
+		found = found && addresses.find( &objects[ i ], id ) && id == i;
+	}
+	EXPECT_TRUE( found );
+	size_t id;
+	EXPECT_FALSE( addresses.find( &id, id ) );
+	EXPECT_EQ( "9999", addresses.idStr( 9999 ) );
+	size_t named = addresses.insert( &id, "#a.b" );
+	EXPECT_EQ( "#a.b", addresses.idStr( named ) );
+	addresses.clear();
+	EXPECT_EQ( 0u, addresses.size() );
+	EXPECT_FALSE( addresses.find( &objects[ 0 ], id ) );
+
+	NameRefMap names;
+	names.add( 3, &objects[ 3 ] );
+	names.add( 1000000000, &objects[ 4 ] );
+	names.add( "#a.b", &objects[ 5 ] );
+	EXPECT_EQ( &objects[ 3 ], names.find( 3 ) );
+	EXPECT_EQ( NULL, names.find( 2 ) );
+	EXPECT_EQ( &objects[ 4 ], names.find( 1000000000 ) );
+	EXPECT_EQ( &objects[ 5 ], names.find( "#a.b" ) );
+	EXPECT_EQ( NULL, names.find( "3" ) );
+	names.add( 5000, &objects[ 6 ] );
+	names.add( 8000, &objects[ 7 ] );
+	names.add( 4000, &objects[ 8 ] );
+	names.add( 8001, &objects[ 9 ] );
+	EXPECT_EQ( &objects[ 6 ], names.find( 5000 ) );
+	EXPECT_EQ( &objects[ 9 ], names.find( 8001 ) );
+
+	// references resolved by integer id in every format
+	Metatype& mt = declare< CloneNode >()
+						.property( "id", &CloneNode::id )
+						.property( "next", &CloneNode::next )
+						.property( "other", &CloneNode::other );
+	CloneNode root( 0 );
+	root.next = new CloneNode( 1 );
+	root.next->other = root.next;
+	root.other = root.next;
+	CloneNode fromJson, fromMsgPack, fromBinary;
+	mt.fromStr( &fromJson, mt.toStr( &root, true ) );
+	mt.fromMsgPack( &fromMsgPack, mt.toMsgPack( &root ) );
+	mt.fromBinary( &fromBinary, mt.toBinary( &root ) );
+	CloneNode * loaded[] = { &fromJson, &fromMsgPack, &fromBinary };
+	for ( int i = 0; i < 3; ++i ) {
+		ASSERT_TRUE( loaded[ i ]->next != NULL );
+		EXPECT_EQ( 1, loaded[ i ]->next->id );
+		EXPECT_EQ( loaded[ i ]->next, loaded[ i ]->next->other );
+		EXPECT_EQ( loaded[ i ]->next, loaded[ i ]->other );
+		delete loaded[ i ]->next;
+	}
+	delete root.next;
+}
+
+// counts the characters written, keeping none
+class CountingBuf : public std::streambuf {
+public:
+	CountingBuf() : count( 0 ), largestWrite( 0 ) {}
+
+	std::streamsize count;
+	std::streamsize largestWrite;
+
+protected:
+	std::streamsize
+	xsputn( const char *, std::streamsize n ) {
+		count += n;
+		largestWrite = std::max( largestWrite, n );
+		return n;
+	}
+
+	int
+	overflow( int c ) {
+		++count;
+		return c;
+	}
+};
+
+TEST_F(MetaTypeTest, toStream) {
+	typedef std::vector< int > Ints;
+	Metatype& mt = declareCollection< Ints >();
+	Ints small;
+	for ( int i = 0; i < 100; ++i ) {
+		small.push_back( i );
+	}
+	std::ostringstream out;
+	mt.toStream( &small, out );
+	EXPECT_EQ( mt.toStr( &small ), out.str() );
+
+	// the text is sent in chunks, never held whole
+	Ints huge( 1000000, 7 );
+	CountingBuf buf;
+	std::ostream sink( &buf );
+	mt.toStream( &huge, sink );
+	EXPECT_GT( buf.count, std::streamsize( 3 * huge.size() ) );
+	EXPECT_LT( buf.largestWrite, std::streamsize( 2 * JSONWriter::defaultBufferSize ) );
+}
+
+TEST_F(MetaTypeTest, arrayReader) {
+	typedef std::vector< Point > Points;
+	Metatype& mt = declareCollection< Points >();
+	Points points;
+	for ( int i = 0; i < 20000; ++i ) {
+		Point p;
+		p.x = i;
+		p.y = -i;
+		points.push_back( p );
+	}
+	std::stringstream collection;
+	mt.toStream( &points, collection );
+	ArrayReader< Point > reader( collection );
+	Point p;
+	int count = 0;
+	bool same = true;
+	while ( reader.next( p ) ) {
+		same = same && p.x == count && p.y == -count;
+		++count;
+	}
+	EXPECT_EQ( 20000, count );
+	EXPECT_TRUE( same );
+	EXPECT_FALSE( reader.next( p ) );
+
+	std::istringstream array( "[ 1, 2,\n 3 ]" );
+	ArrayReader< int > ints( array );
+	int i, sum = 0;
+	while ( ints.next( i ) ) {
+		sum += i;
+	}
+	EXPECT_EQ( 6, sum );
+
+	std::istringstream pointers( "[ { \"x\": 1, \"y\": 2 }, NULL ]" );
+	ArrayReader< Point * > pointReader( pointers );
+	Point * pp;
+	ASSERT_TRUE( pointReader.next( pp ) );
+	ASSERT_TRUE( pp != NULL );
+	EXPECT_EQ( 2, pp->y );
+	delete pp;
+	ASSERT_TRUE( pointReader.next( pp ) );
+	EXPECT_EQ( NULL, pp );
+	EXPECT_FALSE( pointReader.next( pp ) );
+}
+
+struct CountingObserver : PropertyObserver {
+	CountingObserver() : calls( 0 ) {}
+	void propertyChanged( void *, const std::string& ) { ++calls; }
+	int calls;
+};
+
+struct NDJSONUndeclared {
+	int value;
+};
+
+struct NDJSONHolder {
+	NDJSONUndeclared undeclared;
+};
+
+TEST_F(MetaTypeTest, ndjson) {
+	std::stringstream lines;
+	{
+		NDJSONWriter< Point > writer( lines, 1000, 4 );
+		for ( int i = 0; i < 10000; ++i ) {
+			Point p;
+			p.x = i;
+			p.y = i * 0.5;
+			writer.write( p );
+		}
+	}
+	std::string text = lines.str();
+	EXPECT_EQ( 10000, std::count( text.begin(), text.end(), '\n' ) );
+
+	NDJSONReader< Point > reader( lines, 777, 4 );
+	Point p;
+	int count = 0;
+	bool ordered = true;
+	while ( reader.next( p ) ) {
+		ordered = ordered && p.x == count && p.y == count * 0.5;
+		++count;
+	}
+	EXPECT_EQ( 10000, count );
+	EXPECT_TRUE( ordered );
+
+	std::istringstream broken( "{ \"x\": 1, \"y\": 2 }\n\n{ \"x\": 3 \n" );
+	NDJSONReader< Point > brokenReader( broken, 10, 2 );
+	EXPECT_THROW( brokenReader.next( p ), jrtti::Error );
+
+	// records parsed by the reader are not reported to observers
+	CountingObserver observer;
+	PropertyObserver::current() = &observer;
+	std::istringstream few( "{ \"x\": 1, \"y\": 2 }\n{ \"x\": 3, \"y\": 4 }\n" );
+	NDJSONReader< Point > observed( few, 1, 2 );
+	while ( observed.next( p ) ) {}
+	EXPECT_EQ( 0, observer.calls );
+	EXPECT_EQ( &observer, PropertyObserver::current() );
+	PropertyObserver::current() = NULL;
+
+	// plans of types with undeclared properties can not be prepared
+	declare< NDJSONHolder >()
+		.property( "undeclared", &NDJSONHolder::undeclared );
+	EXPECT_THROW( Reflector::instance().prepareSerialization(), jrtti::Error );
+}
+
+struct FormatNode {
+	int count;
+	double ratio;
+	std::string label;
+	FormatNode * self;
+};
+
+// records the events of the traversal as text
+class EventWriter : public Writer {
+public:
+	void beginObject() { events += "{ "; }
+	void writeId( const std::string& id ) { events += "id:" + id + " "; }
+	void key( const std::string& name ) { events += name + "= "; }
+	void endObject() { events += "} "; }
+	void beginArray( size_t count ) { events += "[" + numToStr( count ) + " "; }
+	void endArray() { events += "] "; }
+	void writeRef( const std::string& id ) { events += "ref:" + id + " "; }
+	void writeNull() { events += "null "; }
+	void writeBool( bool value ) { events += value ? "b:1 " : "b:0 "; }
+	void writeInt( boost::int64_t value ) { events += "i:" + numToStr( value ) + " "; }
+	void writeDouble( double value ) { events += "d:" + numToStr( value ) + " "; }
+	void writeString( const std::string& value ) { events += "s:" + value + " "; }
+
+	std::string events;
+};
+
+struct KeyCountingWriter : JSONWriter {
+	KeyCountingWriter() : keys( 0 ) {}
+	void key( const std::string& name ) { ++keys; JSONWriter::key( name ); }
+	int keys;
+};
+
+TEST_F(MetaTypeTest, writerAndReader) {
+	Metatype& mt = declare< FormatNode >()
+						.property( "count", &FormatNode::count )
+						.property( "ratio", &FormatNode::ratio )
+						.property( "label", &FormatNode::label )
+						.property( "self", &FormatNode::self );
+	FormatNode node;
+	node.count = 3;
+	node.ratio = 0.5;
+	node.label = "a/b";
+	node.self = &node;
+
+	EventWriter events;
+	mt.write( &node, events, true );
+	EXPECT_EQ( "{ id:0 count= i:3 label= s:a/b ratio= d:0.5 self= ref:0 } ", events.events );
+
+	node.self = NULL;
+	events.events.clear();
+	mt.write( &node, events );
+	EXPECT_EQ( "{ count= i:3 label= s:a/b ratio= d:0.5 self= null } ", events.events );
+
+	// JSON is one more format
+	node.self = &node;
+	JSONWriter writer;
+	mt.write( &node, writer, true );
+	EXPECT_EQ( mt.toStr( &node, true ), writer.str() );
+
+	FormatNode loaded;
+	loaded.self = NULL;
+	JSONReader reader( writer.str() );
+	mt.read( &loaded, reader );
+	EXPECT_EQ( 3, loaded.count );
+	EXPECT_EQ( 0.5, loaded.ratio );
+	EXPECT_EQ( "a/b", loaded.label );
+	EXPECT_EQ( &loaded, loaded.self );
+
+	// property names are encoded once, only "$id" and "$ref" are escaped per object
+	KeyCountingWriter counting;
+	mt.write( &node, counting, true );
+	EXPECT_EQ( 2, counting.keys );
+	EXPECT_EQ( writer.str(), counting.str() );
+}
+
+// fills sample with dates collection elements
+static
+void
+fillSample( Sample& sample, Point * point, int dates ) {
+	Date date;
+	date.d = 1;
+	date.m = 4;
+	date.y = 2011;
+	date.place.x = 98;
+	date.place.y = 93;
+	sample.setDoubleProp( 65.5 );
+	sample.setStdStringProp( kHelloString );
+	sample.setByValProp( date );
+	sample.setByPtrProp( point );
+	sample.setBool( true );
+	for ( int i = 0; i < 5; ++i ) {
+		sample.getArray()[ i ] = i + 10;
+	}
+	for ( int i = 0; i < dates; ++i ) {
+		date.d = i % 28 + 1;
+		date.y = 2000 + i;
+		sample.getCollection().push_back( date );
+	}
+}
+
+TEST_F(MetaTypeTest, msgPack) {
+	Point point;
+	point.x = 45;
+	point.y = -80;
+	Sample * source = new Sample();
+	fillSample( *source, &point, 20 );
+
+	std::string packed = mClass().toMsgPack( source );
+	Sample * loaded = new Sample();
+	loaded->circularRef = NULL;
+	mClass().fromMsgPack( loaded, packed );
+	EXPECT_EQ( mClass().toStr( source, true ), mClass().toStr( loaded, true ) );
+	EXPECT_EQ( loaded, loaded->circularRef );
+	EXPECT_EQ( -80, loaded->getByPtrProp()->y );
+	EXPECT_EQ( 65.5, loaded->getDoubleProp() );
+	EXPECT_LT( packed.length(), mClass().toStr( source, true ).length() );
+	EXPECT_THROW( mClass().fromMsgPack( loaded, packed.substr( 0, packed.length() / 2 ) ), jrtti::Error );
+
+	delete loaded->getByPtrProp();
+	delete loaded;
+	delete source;
+}
+
+struct MsgPackWide {
+	MsgPackWide() : value( 0 ), next( NULL ) {}
+	int				value;
+	MsgPackWide *	next;
+};
+
+TEST_F(MetaTypeTest, msgPackWideMaps) {
+	CustomMetaclass< MsgPackWide >& mt = declare< MsgPackWide >();
+	for ( int i = 0; i < 16; ++i ) {
+		mt.property( "value" + numToStr( i ), &MsgPackWide::value );
+	}
+	mt.property( "next", &MsgPackWide::next );
+	MsgPackWide inner, outer;
+	inner.value = 7;
+	outer.value = 3;
+	outer.next = &inner;
+
+	// nested maps of 17 keys take map16 headers
+	std::string packed = mt.toMsgPack( &outer );
+	EXPECT_EQ( char( 0xde ), packed[ 0 ] );
+	EXPECT_EQ( 2, std::count( packed.begin(), packed.end(), char( 0xde ) ) );
+	MsgPackWide loaded;
+	mt.fromMsgPack( &loaded, packed );
+	ASSERT_TRUE( loaded.next != NULL );
+	EXPECT_EQ( 3, loaded.value );
+	EXPECT_EQ( 7, loaded.next->value );
+	EXPECT_EQ( mt.toStr( &outer, true ), mt.toStr( &loaded, true ) );
+	delete loaded.next;
+}
+
+TEST_F(MetaTypeTest, DISABLED_msgPackBenchmark) {
+	const int rounds = 10;
+	Point point;
+	point.x = 45;
+	point.y = 80;
+	Sample * source = new Sample();
+	fillSample( *source, &point, 5000 );
+	Sample * loaded = new Sample();
+
+	clock_t start = clock();
+	std::string json;
+	for ( int i = 0; i < rounds; ++i ) {
+		json = mClass().toStr( source, true );
+		loaded->getCollection().clear();
+		mClass().fromStr( loaded, json );
+		delete loaded->getByPtrProp();
+		loaded->setByPtrProp( NULL );
+	}
+	clock_t jsonTime = clock() - start;
+
+	start = clock();
+	std::string packed;
+	for ( int i = 0; i < rounds; ++i ) {
+		packed = mClass().toMsgPack( source );
+		loaded->getCollection().clear();
+		mClass().fromMsgPack( loaded, packed );
+		delete loaded->getByPtrProp();
+		loaded->setByPtrProp( NULL );
+	}
+	clock_t packTime = clock() - start;
+
+	std::cout << "[ BENCHMARK] " << rounds << " round trips of " << source->getCollection().size() << " dates: "
+			  << "JSON " << json.length() << " bytes " << jsonTime * 1000 / CLOCKS_PER_SEC << " ms, "
+			  << "MessagePack " << packed.length() << " bytes " << packTime * 1000 / CLOCKS_PER_SEC << " ms" << std::endl;
+	EXPECT_EQ( source->getCollection().size(), loaded->getCollection().size() );
+	EXPECT_LT( packed.length(), json.length() );
+	delete loaded;
+	delete source;
+}
+
+TEST_F(MetaTypeTest, binaryFormat) {
+	Point point;
+	point.x = 45;
+	point.y = -80;
+	Sample * source = new Sample();
+	fillSample( *source, &point, 20 );
+
+	std::string data = mClass().toBinary( source );
+	Sample * loaded = new Sample();
+	loaded->circularRef = NULL;
+	mClass().fromBinary( loaded, data );
+	EXPECT_EQ( mClass().toStr( source, true ), mClass().toStr( loaded, true ) );
+	EXPECT_EQ( loaded, loaded->circularRef );
+	EXPECT_EQ( -80, loaded->getByPtrProp()->y );
+	EXPECT_EQ( mClass().schemaFingerprint(), BinaryReader( data ).schemaFingerprint() );
+	EXPECT_LT( data.length(), mClass().toStr( source, true ).length() );
+	EXPECT_THROW( mClass().fromBinary( loaded, data.substr( 0, data.length() / 2 ) ), jrtti::Error );
+	EXPECT_THROW( mClass().fromBinary( loaded, mClass().toMsgPack( source ) ), jrtti::Error );
+
+	delete loaded->getByPtrProp();
+	delete loaded;
+	delete source;
+}
+
+struct TableShape {
+	TableShape() : size( 0 ) {}
+	virtual ~TableShape() {}
+	std::string typeInfoName() { return typeid( *this ).name(); }
+	int size;
+};
+
+struct TableCircle : TableShape {
+	TableCircle() : radius( 0 ) {}
+	double radius;
+};
+
+TEST_F(MetaTypeTest, binaryStringTable) {
+	typedef std::vector< TableShape * > Shapes;
+	declare< TableShape >()
+		.property( "__typeInfoName", &TableShape::typeInfoName )
+		.property( "size", &TableShape::size );
+	declare< TableCircle >()
+		.derivesFrom< TableShape >()
+		.property( "radius", &TableCircle::radius );
+	Metatype& mt = declareCollection< Shapes >();
+	Shapes shapes;
+	for ( int i = 0; i < 1000; ++i ) {
+		TableCircle * circle = new TableCircle();
+		circle->size = i;
+		circle->radius = i * 0.5;
+		shapes.push_back( circle );
+	}
+
+	// names and type names are stored once
+	std::string data = mt.toBinary( &shapes );
+	std::string typeName = typeid( TableCircle ).name();
+	EXPECT_NE( std::string::npos, data.find( typeName ) );
+	EXPECT_EQ( data.find( typeName ), data.rfind( typeName ) );
+	EXPECT_EQ( data.find( "__typeInfoName" ), data.rfind( "__typeInfoName" ) );
+
+	Shapes loaded;
+	mt.fromBinary( &loaded, data );
+	ASSERT_EQ( shapes.size(), loaded.size() );
+	TableCircle * last = dynamic_cast< TableCircle * >( loaded.back() );
+	ASSERT_TRUE( last != NULL );
+	EXPECT_EQ( 999, last->size );
+	EXPECT_EQ( 499.5, last->radius );
+
+	// previous versions wrote members in name order, __typeInfoName is not first
+	Shapes old;
+	mt.fromStr( &old, "{ \"properties\": {}, \"elements\": [ { \"$id\": \"1\", \"radius\": 2.5, \"size\": 4, "
+					"\"__typeInfoName\": \"" + typeName + "\" } ] }" );
+	ASSERT_EQ( 1u, old.size() );
+	TableCircle * circle = dynamic_cast< TableCircle * >( old.front() );
+	ASSERT_TRUE( circle != NULL );
+	EXPECT_EQ( 4, circle->size );
+	EXPECT_EQ( 2.5, circle->radius );
+	delete circle;
+
+	for ( size_t i = 0; i < shapes.size(); ++i ) {
+		delete shapes[ i ];
+		delete loaded[ i ];
+	}
+}
+
+struct CountedItem {
+	CountedItem() : value( 0 ) {}
+	CountedItem( const CountedItem& other ) : value( other.value ) { ++copies; }
+	CountedItem& operator = ( const CountedItem& other ) { value = other.value; ++copies; return *this; }
+	int value;
+	static int copies;
+};
+
+int CountedItem::copies = 0;
+
+TEST_F(MetaTypeTest, collectionBulkRead) {
+	typedef std::vector< CountedItem > Items;
+	declare< CountedItem >()
+		.property( "value", &CountedItem::value );
+	Metatype& mt = declareCollection< Items >();
+	Items items( 10000 );
+	for ( size_t i = 0; i < items.size(); ++i ) {
+		items[ i ].value = int( i );
+	}
+	std::string binary = mt.toBinary( &items );
+	std::string packed = mt.toMsgPack( &items );
+	std::string json = mt.toStr( &items );
+
+	// readers know the element count, elements are read in place
+	Items fromBinary, fromMsgPack, fromJson;
+	CountedItem::copies = 0;
+	mt.fromBinary( &fromBinary, binary );
+	mt.fromMsgPack( &fromMsgPack, packed );
+	mt.fromStr( &fromJson, json );
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+	EXPECT_EQ( 0, CountedItem::copies );
+#endif
+	EXPECT_EQ( items.size(), fromBinary.capacity() );
+	EXPECT_EQ( items.size(), fromMsgPack.capacity() );
+	EXPECT_EQ( items.size(), fromJson.capacity() );
+	Items * loaded[] = { &fromBinary, &fromMsgPack, &fromJson };
+	for ( int l = 0; l < 3; ++l ) {
+		ASSERT_EQ( items.size(), loaded[ l ]->size() );
+		EXPECT_EQ( 0, loaded[ l ]->front().value );
+		EXPECT_EQ( 9999, loaded[ l ]->back().value );
+	}
+
+	// collections without back() read a temporary
+	typedef std::set< int > IntSet;
+	Metatype& st = declareCollection< IntSet >();
+	IntSet ints, loadedInts;
+	ints.insert( 3 );
+	ints.insert( 1 );
+	ints.insert( 2 );
+	st.fromBinary( &loadedInts, st.toBinary( &ints ) );
+	EXPECT_TRUE( ints == loadedInts );
+}
+
+struct RecordV1 {
+	int id;
+	std::string label;
+};
+
+struct RecordV2 {
+	int id;
+	std::string title;
+	std::vector< int > tags;
+	double weight;
+};
+
+TEST_F(MetaTypeTest, binarySchemaEvolution) {
+	declareCollection< std::vector< int > >();
+	Metatype& v1 = declare< RecordV1 >()
+						.property( "id", &RecordV1::id )
+						.property( "label", &RecordV1::label, Annotations() << new FieldId( 2 ) );
+	Metatype& v2 = declare< RecordV2 >()
+						.property( "id", &RecordV2::id )
+						.property( "title", &RecordV2::title, Annotations() << new FieldId( 2 ) )
+						.property( "tags", &RecordV2::tags )
+						.property( "weight", &RecordV2::weight );
+	EXPECT_NE( v1.schemaFingerprint(), v2.schemaFingerprint() );
+	EXPECT_THROW( FieldId( 0 ), jrtti::Error );
+
+	RecordV2 record;
+	record.id = 7;
+	record.title = "renamed";
+	record.tags.push_back( 1 );
+	record.tags.push_back( 2 );
+	record.weight = 1.5;
+
+	// fields unknown to the reader are skipped, renamed ones matched by id
+	RecordV1 old;
+	v1.fromBinary( &old, v2.toBinary( &record ) );
+	EXPECT_EQ( 7, old.id );
+	EXPECT_EQ( "renamed", old.label );
+
+	RecordV2 newer;
+	newer.weight = 0;
+	v2.fromBinary( &newer, v1.toBinary( &old ) );
+	EXPECT_EQ( 7, newer.id );
+	EXPECT_EQ( "renamed", newer.title );
+	EXPECT_EQ( 0, newer.weight );
+}
+
+struct Colliding {
+	Colliding() : first( 0 ), second( 0 ) {}
+	int first;
+	int second;
+};
+
+TEST_F(MetaTypeTest, binaryDerivedIdCollision) {
+	// "gqx" and "hdd" derive the same field id
+	Colliding written;
+	written.first = 5;
+	std::string data = declare< Colliding >()
+							.property( "gqx", &Colliding::first )
+							.toBinary( &written );
+
+	Reflector::instance().clear();
+	Metatype& mt = declare< Colliding >()
+						.property( "hdd", &Colliding::second );
+	Colliding loaded;
+	mt.fromBinary( &loaded, data );
+	EXPECT_EQ( 0, loaded.second );
+
+	// same schema, names are not checked
+	loaded.second = 6;
+	mt.fromBinary( &written, mt.toBinary( &loaded ) );
+	EXPECT_EQ( 6, written.second );
+}
+
+struct SnapshotRecord {
+	int id;
+	float weight;
+	Point place;
+};
+
+TEST_F(MetaTypeTest, snapshotView) {
+	Metatype& mt = declare< SnapshotRecord >()
+						.property( "id", &SnapshotRecord::id )
+						.property( "weight", &SnapshotRecord::weight )
+						.property( "place", &SnapshotRecord::place );
+	ASSERT_TRUE( mt.isPOD() );
+	std::vector< SnapshotRecord > records( 1000 );
+	for ( size_t i = 0; i < records.size(); ++i ) {
+		records[ i ].id = int( i );
+		records[ i ].weight = i * 0.5f;
+		records[ i ].place.x = double( i );
+		records[ i ].place.y = -double( i );
+	}
+	{
+		SnapshotWriter writer( mt, "snapshot.jrs" );
+		writer.write( &records[ 0 ], 500 );
+		writer.write( &records[ 500 ], records.size() - 500 );
+	}
+
+	{
+		SnapshotView view( mt, "snapshot.jrs" );
+		EXPECT_EQ( records.size(), view.size() );
+		ObjectView record = view[ 731 ];
+		EXPECT_EQ( 731, record.get< int >( "id" ) );
+		EXPECT_EQ( 365.5f, record.get< float >( "weight" ) );
+		EXPECT_EQ( -731, record.get< double >( "place.y" ) );
+		EXPECT_EQ( mt.toStr( &records[ 731 ] ), record.toStr() );
+		EXPECT_EQ( 731, record.objectInstance< SnapshotRecord >()->id );
+		EXPECT_THROW( view[ records.size() ], jrtti::Error );
+		EXPECT_THROW( SnapshotView( jrtti::metatype< Point >(), "snapshot.jrs" ), jrtti::Error );
+	}
+	EXPECT_THROW( SnapshotWriter( jrtti::metatype< Date >(), "date.jrs" ), jrtti::Error );
+	EXPECT_FALSE( std::ifstream( "date.jrs" ) );
+	std::remove( "snapshot.jrs" );
+}
+
 TEST_F(MetaTypeTest, checkUseCase) {
 	useCase();
 }